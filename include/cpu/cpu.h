@@ -19,6 +19,10 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+uint64_t cpu_exec_time();
+
+// set when an interrupt may have become deliverable
+extern bool g_intr_pending;
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
@@ -28,6 +28,8 @@ typedef struct Decode {
   IFDEF(CONFIG_RTRACE, size_t index);
   IFDEF(CONFIG_RTRACE, size_t count);
   IFDEF(CONFIG_MTRACE, char membuf[128]);
+  IFDEF(CONFIG_INST_FUSION, bool fuse);    // whether it can be fused with the next instruction
+  IFDEF(CONFIG_INST_FUSION, int nr_inst);  // 2 if the next instruction is fused
 } Decode;
 
 // --- pattern matching mechanism ---
@@ -90,12 +92,39 @@ finish:
 }
 
 
+// --- per-pattern execution counters ---
+#ifdef CONFIG_INST_STAT
+typedef struct InstStat {
+  const char *name;
+  uint64_t count;
+  uint64_t cycles; // host cycles spent in the execute body
+  struct InstStat *next;
+} InstStat;
+
+void inst_stat_register(InstStat *st, const char *name);
+void inst_stat_display();
+
+#define __instpat_name(name, ...) #name
+#define INSTPAT_STAT_START() \
+  static InstStat __inst_stat = { .name = NULL }; \
+  uint64_t __inst_cycles = get_host_cycles();
+#define INSTPAT_STAT_END(...) \
+  if (unlikely(__inst_stat.name == NULL)) inst_stat_register(&__inst_stat, __instpat_name(__VA_ARGS__)); \
+  __inst_stat.count ++; \
+  __inst_stat.cycles += get_host_cycles() - __inst_cycles;
+#else
+#define INSTPAT_STAT_START()
+#define INSTPAT_STAT_END(...)
+#endif
+
 // --- pattern matching wrappers for decode ---
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_STAT_START(); \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
+    INSTPAT_STAT_END(__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
 } while (0)
@@ -24,13 +24,18 @@ void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_intr(word_t NO);
+void difftest_sync(paddr_t addr, size_t len);
 void difftest_detach();
 void difftest_attach();
+extern uint64_t g_nr_difftest_inst;
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_intr(word_t NO) {}
+static inline void difftest_sync(paddr_t addr, size_t len) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
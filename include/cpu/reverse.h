@@ -0,0 +1,43 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_REVERSE_H__
+#define __CPU_REVERSE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_REVERSE_EXEC
+extern uint64_t reverse_next_checkpoint;
+extern bool reverse_rewinding;
+void reverse_checkpoint();
+void reverse_save_page(paddr_t page);
+bool reverse_replaying();
+word_t reverse_replay_input();
+void reverse_record_input(word_t val);
+word_t reverse_replay_intr();
+void reverse_record_intr(word_t NO);
+void reverse_replay_dma();
+void reverse_record_dma(uint8_t *buf, size_t len);
+void reverse_step(uint64_t n);
+void reverse_continue();
+#else
+#define reverse_rewinding false
+static inline bool reverse_replaying() { return false; }
+static inline void reverse_record_input(word_t val) {}
+static inline void reverse_record_intr(word_t NO) {}
+static inline void reverse_record_dma(uint8_t *buf, size_t len) {}
+#endif
+
+#endif
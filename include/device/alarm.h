@@ -16,9 +16,13 @@
 #ifndef __DEVICE_ALARM_H__
 #define __DEVICE_ALARM_H__
 
+#include <common.h>
+
 #define TIMER_HZ 60
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+void alarm_update();
+void alarm_idle(uint64_t us);
 
 #endif
@@ -0,0 +1,29 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
+
+// interrupt lines of the devices, which are also their PLIC source ids
+enum {
+  IRQ_RTC    = 1,
+  IRQ_DISK   = 2,
+  IRQ_SDCARD = 3,
+  NR_IRQ     = 32
+};
+
+void dev_raise_intr(int irq);
+
+#endif
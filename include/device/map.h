@@ -28,6 +28,8 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  IFDEF(CONFIG_STATS, uint64_t nr_read);
+  IFDEF(CONFIG_STATS, uint64_t nr_write);
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -50,6 +52,8 @@ void add_pio_map(const char *name, ioaddr_t addr,
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 
+IFDEF(CONFIG_STATS, void stats_add_map(IOMap *map));
+
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
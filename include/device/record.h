@@ -0,0 +1,32 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_RECORD_H__
+#define __DEVICE_RECORD_H__
+
+#include <common.h>
+
+enum { RECORD_OFF, RECORD_ON, REPLAY_ON };
+extern int record_mode;
+
+static inline bool record_replaying() { return record_mode == REPLAY_ON; }
+
+void init_record(const char *record_file, const char *replay_file);
+word_t record_input(paddr_t addr, word_t val);
+void record_alarm();
+bool record_replay_alarm();
+void record_flush();
+
+#endif
@@ -55,5 +55,8 @@ word_t isa_query_intr();
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc, vaddr_t npc);
 void isa_difftest_attach();
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+bool isa_difftest_ff_barrier(vaddr_t pc);
+#endif
 
 #endif
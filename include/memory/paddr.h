@@ -33,5 +33,21 @@ static inline bool in_pmem(paddr_t addr) {
 
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
+/* host address of [addr, addr + len) for device DMA, or NULL if it is not in pmem */
+uint8_t* paddr_dma(paddr_t addr, size_t len, bool is_write);
+
+#ifdef CONFIG_WATCHPOINT
+/* mark the pages covering [addr, addr + len) as watched by watchpoints */
+void paddr_watch(paddr_t addr, int len);
+void paddr_watch_clear();
+#else
+static inline void paddr_watch(paddr_t addr, int len) {}
+static inline void paddr_watch_clear() {}
+#endif
+
+#ifdef CONFIG_REVERSE_EXEC
+/* forget the pages saved since the last checkpoint of reverse execution */
+void paddr_saved_clear();
+#endif
 
 #endif
@@ -33,6 +33,15 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+uint64_t get_host_cycles();
+
+// ----------- stats -----------
+
+#ifdef CONFIG_STATS
+extern uint64_t g_nr_trap;
+extern uint64_t stats_next_update;
+void stats_update();
+#endif
 
 // ----------- log -----------
 
@@ -55,6 +55,16 @@
 #define SDHBCT 0x3c /* Host byte count (debug)         - 32 R/W */
 #define SDDATA 0x40 /* Data to/from SD card            - 32 R/W */
 #define SDHBLC 0x50 /* Host block count (SDIO/SDHC)    -  9 R/W */
+#define SDDMAADDR 0x60 /* DMA guest physical address   - 32 R/W */
+#define SDDMACNT  0x64 /* DMA block count              - 16 R/W */
+#define SDDMACTL  0x68 /* DMA control and status       -  4 R/W */
+
+#define SDDMA_START			0x1
+#define SDDMA_IRQ			0x2
+#define SDDMA_DONE			0x4
+#define SDDMA_ERROR			0x8
+
+#define SDDMA_BLOCK_SIZE	512
 
 #define SDCMD_NEW_FLAG			0x8000
 #define SDCMD_FAIL_FLAG			0x4000
@@ -95,6 +105,7 @@ struct nemu_host {
 	struct mmc_data		*data;		/* Current data request */
 	bool			data_complete:1;/* Data finished before cmd */
 	bool			use_sbc:1;	/* Send CMD23 */
+	bool			use_dma:1;	/* Transfer data by DMA */
 };
 
 static void nemu_reset(struct mmc_host *mmc)
@@ -102,6 +113,7 @@ static void nemu_reset(struct mmc_host *mmc)
 }
 
 static void nemu_finish_command(struct nemu_host *host);
+static void nemu_finish_data(struct nemu_host *host);
 
 static void nemu_transfer_block_pio(struct nemu_host *host, bool is_read)
 {
@@ -175,6 +187,58 @@ static void nemu_transfer_pio(struct nemu_host *host)
 	nemu_transfer_block_pio(host, is_read);
 }
 
+/* Transfer each segment with one DMA request. The device finishes the
+ * request before the write to SDDMACTL returns, so there is nothing to wait.
+ */
+static bool nemu_transfer_dma(struct nemu_host *host)
+{
+	struct mmc_data *data = host->data;
+	struct device *dev = mmc_dev(host->mmc);
+	enum dma_data_direction dir;
+	struct scatterlist *sg;
+	int i, sg_len;
+
+	if (!host->use_dma || data->blksz != SDDMA_BLOCK_SIZE)
+		return false;
+
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		if (sg->length % SDDMA_BLOCK_SIZE)
+			return false;
+	}
+
+	dir = (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	sg_len = dma_map_sg(dev, data->sg, data->sg_len, dir);
+	if (sg_len == 0)
+		return false;
+
+	for_each_sg(data->sg, sg, sg_len, i) {
+		writel(sg_dma_address(sg), host->ioaddr + SDDMAADDR);
+		writel(sg_dma_len(sg) / SDDMA_BLOCK_SIZE, host->ioaddr + SDDMACNT);
+		writel(SDDMA_START, host->ioaddr + SDDMACTL);
+		if (readl(host->ioaddr + SDDMACTL) & SDDMA_ERROR) {
+			data->error = -EIO;
+			break;
+		}
+	}
+
+	dma_unmap_sg(dev, data->sg, data->sg_len, dir);
+	return true;
+}
+
+static void nemu_transfer_data(struct nemu_host *host)
+{
+	int i;
+
+	if (!nemu_transfer_dma(host)) {
+		// start PIO right now
+		for (i = 0; i < host->data->blocks; i ++) {
+			nemu_transfer_pio(host);
+		}
+	}
+
+	nemu_finish_data(host);
+}
+
 static
 void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 {
@@ -315,14 +379,8 @@ static void nemu_finish_command(struct nemu_host *host)
 		/* Finished CMD23, now send actual command. */
 		host->cmd = NULL;
 		if (nemu_send_command(host, host->mrq->cmd)) {
-			if (host->data) {
-        // start PIO right now
-        for (i = 0; i < host->data->blocks; i ++) {
-          nemu_transfer_pio(host);
-        }
-
-        nemu_finish_data(host);
-      }
+			if (host->data)
+				nemu_transfer_data(host);
 
       nemu_finish_command(host);
 		}
@@ -379,14 +437,8 @@ static void nemu_request(struct mmc_host *mmc, struct mmc_request *mrq)
       nemu_finish_command(host);
 		}
 	} else if (mrq->cmd && nemu_send_command(host, mrq->cmd)) {
-		if (host->data) {
-      int i;
-      // start PIO right now
-      for (i = 0; i < host->data->blocks; i ++) {
-        nemu_transfer_pio(host);
-      }
-      nemu_finish_data(host);
-    }
+		if (host->data)
+			nemu_transfer_data(host);
 
     nemu_finish_command(host);
 	}
@@ -441,7 +493,7 @@ static int nemu_add_host(struct nemu_host *host)
 		return ret;
 	}
 
-	dev_info(dev, "loaded - DMA %s\n", "disabled");
+	dev_info(dev, "loaded - DMA %s\n", host->use_dma ? "enabled" : "disabled");
 
 	return 0;
 }
@@ -487,6 +539,10 @@ static int nemu_probe(struct platform_device *pdev)
 
 	host->max_clk = 1000000; //clk_get_rate(clk);
 
+	/* The device takes 32-bit guest physical addresses for DMA. */
+	host->use_dma = !of_property_read_bool(pdev->dev.of_node, "nemu,no-dma") &&
+			!dma_set_mask_and_coherent(dev, DMA_BIT_MASK(32));
+
 	ret = mmc_of_parse(mmc);
 	if (ret)
 		goto err;
@@ -41,6 +41,12 @@ gdb: run-env
 	$(call git_commit, "gdb NEMU")
 	gdb -s $(BINARY) --args $(NEMU_EXEC)
 
+# Run the microbenchmark suite and write the report to $(BUILD_DIR)/bench.json
+BENCH_ARGS ?=
+BENCH_ARGS += $(if $(CONFIG_HAS_VGA),--fb=$(CONFIG_FB_ADDR))
+bench: $(BINARY)
+	python3 $(NEMU_HOME)/tools/bench/bench.py --nemu=$(BINARY) --isa=$(GUEST_ISA) --out=$(BUILD_DIR)/bench.json $(BENCH_ARGS)
+
 count:
 	@find $(NEMU_HOME) -type f \( -name "*.c" -o -name "*.h" \)  -exec grep -c '.' {} + | awk -F : '{s += $$2} END {print s}'
 
@@ -50,4 +56,4 @@ $(clean-tools):
 clean-tools: $(clean-tools)
 clean-all: clean distclean clean-tools
 
-.PHONY: run gdb run-env clean-tools clean-all $(clean-tools)
+.PHONY: run gdb run-env bench clean-tools clean-all $(clean-tools)
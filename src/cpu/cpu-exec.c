@@ -16,6 +16,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/reverse.h>
+#include <device/record.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -27,13 +29,21 @@
 
 CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
+bool g_intr_pending = false;
 static uint64_t g_timer = 0; // unit: us
+static uint64_t g_timer_start = 0;
+static uint64_t g_cycles = 0; // unit: host cycles
 static bool g_print_step = false;
 static bool g_print_ring = false;
 Decode s;
 
 bool watchpoint_diff();
+bool breakpoint_check(vaddr_t pc);
+bool watchpoint_any();
+bool breakpoint_any();
 void device_update();
+void serial_flush();
+void record_flush();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -44,6 +54,11 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
   if (watchpoint_diff()) {
     nemu_state.state = NEMU_STOP;
   }
+#endif
+#ifdef CONFIG_BREAKPOINT
+  if (breakpoint_check(dnpc)) {
+    nemu_state.state = NEMU_STOP;
+  }
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
 
@@ -132,13 +147,59 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #endif
 }
 
+#ifdef CONFIG_INST_FUSION
+// A fused pair is committed at once, so it is not allowed
+// if the debugger may stop between the two instructions.
+// It is neither allowed when recording or replaying, since the points
+// where alarms are taken must not depend on which pairs are fused.
+static bool can_fuse() {
+  return !MUXDEF(CONFIG_RECORD_REPLAY, record_mode != RECORD_OFF, false) &&
+         !MUXDEF(CONFIG_WATCHPOINT, watchpoint_any(), false) &&
+         !MUXDEF(CONFIG_BREAKPOINT, breakpoint_any(), false);
+}
+#endif
+
+#ifdef CONFIG_DEVICE
+// Interrupts are only taken at the end of a basic block, and only after
+// g_intr_pending is set, so the other instructions pay for a single test.
+static void check_intr() {
+  word_t NO;
+  if (reverse_replaying()) NO = MUXDEF(CONFIG_REVERSE_EXEC, reverse_replay_intr(), INTR_EMPTY);
+  else {
+    g_intr_pending = false;
+    NO = isa_query_intr();
+    if (NO != INTR_EMPTY) reverse_record_intr(NO);
+  }
+  if (NO == INTR_EMPTY) return;
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+  IFDEF(CONFIG_DIFFTEST, difftest_intr(NO));
+  // the breakpoints were checked against the pc before the interrupt
+#ifdef CONFIG_BREAKPOINT
+  if (breakpoint_check(cpu.pc)) {
+    nemu_state.state = NEMU_STOP;
+  }
+#endif
+}
+#endif
+
 static void execute(uint64_t n) {
+  IFDEF(CONFIG_INST_FUSION, bool fuse = can_fuse());
   for (;n > 0; n --) {
+    IFDEF(CONFIG_REVERSE_EXEC, if (g_nr_guest_inst >= reverse_next_checkpoint) reverse_checkpoint());
+    IFDEF(CONFIG_STATS, if (g_nr_guest_inst >= stats_next_update) stats_update());
+    IFDEF(CONFIG_INST_FUSION, s.fuse = fuse && n > 1);
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
+    IFDEF(CONFIG_INST_FUSION, if (s.nr_inst > 1) { g_nr_guest_inst ++; n --; s.nr_inst = 1; });
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
     IFDEF(CONFIG_DEVICE, device_update());
+#ifdef CONFIG_DEVICE
+    if (unlikely(g_intr_pending || reverse_replaying()) && s.dnpc != s.snpc) {
+      check_intr();
+      if (nemu_state.state != NEMU_RUNNING) break;
+    }
+#endif
   }
 }
 
@@ -149,17 +210,28 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  if (g_cycles > 0 && g_nr_guest_inst > 0)
+    Log("host cycles per guest instruction = %.2f", (double)g_cycles / g_nr_guest_inst);
+  IFDEF(CONFIG_INST_STAT, inst_stat_display());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+  IFDEF(CONFIG_RECORD_REPLAY, record_flush());
   isa_reg_display();
   statistic();
 }
 
+// host time spent in cpu_exec() until now, called during the execution
+uint64_t cpu_exec_time() {
+  return g_timer + get_time() - g_timer_start;
+}
+
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
   g_print_ring = (n < MAX_INST_TO_PRINT);
+  IFDEF(CONFIG_REVERSE_EXEC, if (reverse_rewinding) g_print_step = g_print_ring = false);
   switch (nemu_state.state) {
     case NEMU_END: case NEMU_ABORT: case NEMU_QUIT:
       printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
@@ -167,12 +239,17 @@ void cpu_exec(uint64_t n) {
     default: nemu_state.state = NEMU_RUNNING;
   }
 
-  uint64_t timer_start = get_time();
+  g_timer_start = get_time();
+  uint64_t cycles_start = get_host_cycles();
 
   execute(n);
+  // the guest output comes before the messages of NEMU
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
 
+  g_cycles += get_host_cycles() - cycles_start;
   uint64_t timer_end = get_time();
-  g_timer += timer_end - timer_start;
+  g_timer += timer_end - g_timer_start;
+  IFDEF(CONFIG_STATS, stats_update());
 
   switch (nemu_state.state) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
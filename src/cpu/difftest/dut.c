@@ -30,6 +30,13 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+uint64_t g_nr_difftest_inst = 0; // instructions passed to difftest_step()
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+// number of instructions executed by DUT but not yet by REF
+static uint64_t ff_nr_inst = 0;
+// the state of DUT before executing the latest instruction
+static CPU_state ff_last_cpu = {};
+#endif
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -54,6 +61,12 @@ void difftest_skip_ref() {
 void difftest_skip_dut(int nr_ref, int nr_dut) {
   skip_dut_nr_inst += nr_dut;
 
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+  // REF should catch up with DUT before running ahead of it
+  if (ff_nr_inst > 0) ref_difftest_exec(ff_nr_inst);
+  ff_nr_inst = 0;
+#endif
+
   while (nr_ref -- > 0) {
     ref_difftest_exec(1);
   }
@@ -81,6 +94,16 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+#ifdef DIFFTEST_CTX_VERSION
+  // a REF without the symbol is older than the versioned context
+  uint32_t *ref_ctx_version = dlsym(handle, "difftest_ctx_version");
+  Assert(ref_ctx_version != NULL, "%s does not export difftest_ctx_version, "
+      "but NEMU expects version %d. Please rebuild the REF.", ref_so_file, DIFFTEST_CTX_VERSION);
+  Assert(*ref_ctx_version == DIFFTEST_CTX_VERSION,
+      "The register context of %s is version %d, but NEMU expects version %d. "
+      "Please rebuild the REF.", ref_so_file, *ref_ctx_version, DIFFTEST_CTX_VERSION);
+#endif
+
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
@@ -89,6 +112,7 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_FAST_FORWARD, ff_last_cpu = cpu);
 }
 
 
@@ -101,10 +125,46 @@ static void checkregs(CPU_state *ref, vaddr_t pc, vaddr_t npc) {
   }
 }
 
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+// Let REF catch up with DUT by running `n` instructions at once, and then
+// check the state of REF against `dut`.
+static void ff_checkpoint(uint64_t n, CPU_state *dut, vaddr_t pc, vaddr_t npc) {
+  CPU_state ref_r;
+  if (n > 0) ref_difftest_exec(n);
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  CPU_state dut_r = cpu;
+  cpu = *dut;
+  checkregs(&ref_r, pc, npc);
+  cpu = dut_r;
+}
+
+static void ff_step(vaddr_t pc, vaddr_t npc) {
+  if (is_skip_ref) {
+    // REF should stop right before the instruction which accesses the device
+    ff_checkpoint(ff_nr_inst, &ff_last_cpu, pc, pc);
+    ff_nr_inst = 0;
+    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    is_skip_ref = false;
+  } else if (isa_difftest_ff_barrier(pc)) {
+    // run the instructions before natively, but single-step this one
+    if (ff_nr_inst > 0) ref_difftest_exec(ff_nr_inst);
+    ff_checkpoint(1, &cpu, pc, npc);
+    ff_nr_inst = 0;
+  } else if (++ ff_nr_inst >= CONFIG_DIFFTEST_CHECKPOINT_INTERVAL) {
+    ff_checkpoint(ff_nr_inst, &cpu, pc, npc);
+    ff_nr_inst = 0;
+  }
+  ff_last_cpu = cpu;
+}
+#endif
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  g_nr_difftest_inst ++;
+
   if (skip_dut_nr_inst > 0) {
+    IFDEF(CONFIG_DIFFTEST_FAST_FORWARD, ff_last_cpu = cpu);
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
@@ -117,6 +177,8 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     return;
   }
 
+  IFDEF(CONFIG_DIFFTEST_FAST_FORWARD, ff_step(pc, npc); return);
+
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
@@ -129,6 +191,30 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
 
   checkregs(&ref_r, pc, npc);
 }
+
+// called after DUT takes the interrupt `NO'
+void difftest_intr(word_t NO) {
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+  // REF should catch up with DUT to take the interrupt at the same point
+  ff_checkpoint(ff_nr_inst, &ff_last_cpu, ff_last_cpu.pc, ff_last_cpu.pc);
+  ff_nr_inst = 0;
+  ff_last_cpu = cpu;
+#endif
+  ref_difftest_raise_intr(NO);
+}
+
+// Called after the debugger writes the registers of DUT, and also
+// [addr, addr + len) of pmem if len > 0, to write the same to REF.
+void difftest_sync(paddr_t addr, size_t len) {
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+  // REF should catch up with DUT before it is overwritten
+  if (ff_nr_inst > 0) ref_difftest_exec(ff_nr_inst);
+  ff_nr_inst = 0;
+  ff_last_cpu = cpu;
+#endif
+  if (len > 0) ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+}
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
 #endif
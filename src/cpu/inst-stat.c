@@ -0,0 +1,63 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+#ifdef CONFIG_INST_STAT
+
+// Every INSTPAT owns a static counter, which is linked here when the
+// pattern is matched for the first time.
+static InstStat *head = NULL;
+static int nr_stat = 0;
+
+void inst_stat_register(InstStat *st, const char *name) {
+  st->name = name;
+  st->next = head;
+  head = st;
+  nr_stat ++;
+}
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = (*(InstStat **)a)->count, y = (*(InstStat **)b)->count;
+  return (x < y) - (x > y);
+}
+
+void inst_stat_display() {
+  if (nr_stat == 0) {
+    printf("No instruction has been executed.\n");
+    return;
+  }
+
+  InstStat **list = malloc(sizeof(*list) * nr_stat);
+  uint64_t total = 0, total_cycles = 0;
+  int i = 0;
+  for (InstStat *st = head; st != NULL; st = st->next) {
+    list[i ++] = st;
+    total += st->count;
+    total_cycles += st->cycles;
+  }
+  qsort(list, nr_stat, sizeof(*list), cmp_count);
+
+  _Log("%-12s %16s %7s %16s %7s %12s\n", "inst", "count", "count%", "host cycles", "cycle%", "cycles/inst");
+  for (i = 0; i < nr_stat; i ++) {
+    InstStat *st = list[i];
+    _Log("%-12s %16" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%% %12.2f\n", st->name, st->count,
+        100.0 * st->count / total, st->cycles,
+        (total_cycles ? 100.0 * st->cycles / total_cycles : 0.0), (double)st->cycles / st->count);
+  }
+  free(list);
+}
+
+#endif
@@ -0,0 +1,264 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/reverse.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_REVERSE_EXEC
+
+// Reverse execution restores the nearest checkpoint before the target, and
+// replays the guest from there. A checkpoint only keeps the registers, while
+// a page of pmem is saved before its first write after the checkpoint.
+// Values returned by device reads, the data written to pmem by devices and
+// the interrupts taken are the only non-deterministic inputs of the guest,
+// so they are logged and fed back during replay.
+
+enum { LOG_INPUT, LOG_INTR, LOG_DMA };
+
+typedef struct {
+  paddr_t addr;
+  uint8_t *data;
+} SavedPage;
+
+typedef struct {
+  uint64_t nr_inst;
+  CPU_state cpu;
+  size_t log_idx;
+  SavedPage *page;
+  int nr_page, max_page;
+} Checkpoint;
+
+typedef struct {
+  uint64_t nr_inst; // when the value is read, the interrupt is taken or pmem is written
+  word_t val;       // the value read, the interrupt number or the address written
+  int type;
+  size_t len;       // the data written by LOG_DMA
+  uint8_t *data;
+} InputLog;
+
+extern uint64_t g_nr_guest_inst;
+void watchpoint_refresh();
+void device_refresh_intr();
+
+uint64_t reverse_next_checkpoint = 0;
+// set when replaying the guest to go back, to keep cpu_exec() quiet
+bool reverse_rewinding = false;
+
+static Checkpoint ckpt[CONFIG_REVERSE_NR_CHECKPOINT] = {};
+static int nr_ckpt = 0;
+
+static InputLog *input_log = NULL;
+static size_t nr_log = 0, max_log = 0;
+static size_t log_idx = 0; // next input to replay
+// the guest is replayed until it reaches the furthest point it ran to
+static uint64_t live_inst = 0;
+
+static void drop_oldest_checkpoint() {
+  Checkpoint *c = &ckpt[0];
+  for (int i = 0; i < c->nr_page; i ++) free(c->page[i].data);
+  free(c->page);
+
+  // inputs before the new oldest checkpoint are not needed any more
+  size_t n = ckpt[1].log_idx;
+  for (size_t i = 0; i < n; i ++) free(input_log[i].data);
+  memmove(input_log, input_log + n, sizeof(InputLog) * (nr_log - n));
+  nr_log -= n;
+  log_idx -= n;
+  for (int i = 1; i < nr_ckpt; i ++) ckpt[i].log_idx -= n;
+
+  memmove(&ckpt[0], &ckpt[1], sizeof(Checkpoint) * (nr_ckpt - 1));
+  nr_ckpt --;
+  memset(&ckpt[nr_ckpt], 0, sizeof(Checkpoint));
+}
+
+void reverse_checkpoint() {
+  if (nr_ckpt == CONFIG_REVERSE_NR_CHECKPOINT) drop_oldest_checkpoint();
+  Checkpoint *c = &ckpt[nr_ckpt ++];
+  c->nr_inst = g_nr_guest_inst;
+  c->cpu = cpu;
+  c->log_idx = log_idx;
+  c->nr_page = 0;
+  paddr_saved_clear();
+  reverse_next_checkpoint = g_nr_guest_inst + CONFIG_REVERSE_CHECKPOINT_INTERVAL;
+}
+
+// called by paddr_write() before the first write to `page` after a checkpoint
+void reverse_save_page(paddr_t page) {
+  if (nr_ckpt == 0) return;
+  Checkpoint *c = &ckpt[nr_ckpt - 1];
+  if (c->nr_page == c->max_page) {
+    c->max_page = (c->max_page == 0 ? 64 : c->max_page * 2);
+    c->page = realloc(c->page, sizeof(SavedPage) * c->max_page);
+    assert(c->page);
+  }
+  uint8_t *data = malloc(PAGE_SIZE);
+  assert(data);
+  memcpy(data, guest_to_host(page), PAGE_SIZE);
+  c->page[c->nr_page ++] = (SavedPage) { .addr = page, .data = data };
+}
+
+bool reverse_replaying() {
+  return g_nr_guest_inst < live_inst;
+}
+
+word_t reverse_replay_input() {
+  Assert(log_idx < nr_log && input_log[log_idx].nr_inst == g_nr_guest_inst && input_log[log_idx].type == LOG_INPUT,
+      "replay diverges at pc = " FMT_WORD, cpu.pc);
+  return input_log[log_idx ++].val;
+}
+
+// the interrupt taken at this point, or INTR_EMPTY
+word_t reverse_replay_intr() {
+  if (log_idx < nr_log && input_log[log_idx].nr_inst == g_nr_guest_inst && input_log[log_idx].type == LOG_INTR) {
+    return input_log[log_idx ++].val;
+  }
+  return INTR_EMPTY;
+}
+
+// The devices are not run during replay, so write the data they wrote to
+// pmem at this point again, called instead of the callback of map_write().
+void reverse_replay_dma() {
+  while (log_idx < nr_log && input_log[log_idx].nr_inst == g_nr_guest_inst && input_log[log_idx].type == LOG_DMA) {
+    InputLog *l = &input_log[log_idx ++];
+    memcpy(paddr_dma(l->val, l->len, true), l->data, l->len);
+  }
+}
+
+static InputLog* record(word_t val, int type) {
+  if (nr_log == max_log) {
+    max_log = (max_log == 0 ? 1024 : max_log * 2);
+    input_log = realloc(input_log, sizeof(InputLog) * max_log);
+    assert(input_log);
+  }
+  InputLog *l = &input_log[nr_log ++];
+  *l = (InputLog) { .nr_inst = g_nr_guest_inst, .val = val, .type = type };
+  log_idx = nr_log;
+  return l;
+}
+
+void reverse_record_input(word_t val) {
+  record(val, LOG_INPUT);
+}
+
+void reverse_record_intr(word_t NO) {
+  record(NO, LOG_INTR);
+}
+
+// called by a device after it writes [buf, buf + len) of pmem
+void reverse_record_dma(uint8_t *buf, size_t len) {
+  InputLog *l = record(host_to_guest(buf), LOG_DMA);
+  l->len = len;
+  l->data = malloc(len);
+  assert(l->data);
+  memcpy(l->data, buf, len);
+}
+
+static void restore(int k) {
+  if (g_nr_guest_inst > live_inst) live_inst = g_nr_guest_inst;
+
+  // undo the writes from the latest checkpoint back to checkpoint k
+  for (int i = nr_ckpt - 1; i >= k; i --) {
+    Checkpoint *c = &ckpt[i];
+    for (int j = c->nr_page - 1; j >= 0; j --) {
+      memcpy(guest_to_host(c->page[j].addr), c->page[j].data, PAGE_SIZE);
+      free(c->page[j].data);
+    }
+    c->nr_page = 0;
+    if (i > k) {
+      free(c->page);
+      memset(c, 0, sizeof(*c));
+    }
+  }
+  nr_ckpt = k + 1;
+  paddr_saved_clear();
+
+  cpu = ckpt[k].cpu;
+  g_nr_guest_inst = ckpt[k].nr_inst;
+  log_idx = ckpt[k].log_idx;
+  reverse_next_checkpoint = g_nr_guest_inst + CONFIG_REVERSE_CHECKPOINT_INTERVAL;
+  nemu_state.state = NEMU_STOP;
+  // the devices are not restored, so check the interrupts again
+  IFDEF(CONFIG_DEVICE, device_refresh_intr());
+  g_intr_pending = true;
+  watchpoint_refresh();
+}
+
+// index of the latest checkpoint taken no later than `nr_inst`
+static int find_checkpoint(uint64_t nr_inst) {
+  int k;
+  for (k = nr_ckpt - 1; k > 0 && ckpt[k].nr_inst > nr_inst; k --);
+  return k;
+}
+
+// Run until `target` instructions are executed. Return the instruction count
+// of the last stop by breakpoints or watchpoints before `target`, or 0 if none.
+static uint64_t run_to(uint64_t target) {
+  uint64_t last_stop = 0;
+  while (g_nr_guest_inst < target) {
+    cpu_exec(target - g_nr_guest_inst);
+    if (nemu_state.state != NEMU_STOP) break;
+    if (g_nr_guest_inst < target) last_stop = g_nr_guest_inst;
+  }
+  return last_stop;
+}
+
+void reverse_step(uint64_t n) {
+  if (nr_ckpt == 0) {
+    printf("No execution history\n");
+    return;
+  }
+  uint64_t target = (g_nr_guest_inst > n ? g_nr_guest_inst - n : 0);
+  if (target < ckpt[0].nr_inst) {
+    printf("Can not go back beyond the oldest checkpoint\n");
+    target = ckpt[0].nr_inst;
+  }
+  reverse_rewinding = true;
+  restore(find_checkpoint(target));
+  run_to(target);
+  reverse_rewinding = false;
+  printf("Stop at pc = " FMT_WORD " after %" PRIu64 " instructions\n", cpu.pc, g_nr_guest_inst);
+}
+
+void reverse_continue() {
+  if (nr_ckpt == 0) {
+    printf("No execution history\n");
+    return;
+  }
+  // the stop at the current position does not count
+  uint64_t limit = g_nr_guest_inst;
+  reverse_rewinding = true;
+  for (int k = find_checkpoint(limit); k >= 0; k --) {
+    if (ckpt[k].nr_inst >= limit) continue;
+    // find the last stop before `limit`, then go to it
+    restore(k);
+    uint64_t stop = run_to(limit);
+    if (stop != 0) {
+      restore(k);
+      run_to(stop);
+      reverse_rewinding = false;
+      printf("Stop at pc = " FMT_WORD " after %" PRIu64 " instructions\n", cpu.pc, g_nr_guest_inst);
+      return;
+    }
+    // a stop right at this checkpoint is found in the previous interval
+    limit = ckpt[k].nr_inst + 1;
+  }
+  restore(0);
+  reverse_rewinding = false;
+  printf("Reach the oldest checkpoint at pc = " FMT_WORD "\n", cpu.pc);
+}
+#endif
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/alarm.h>
+#include <device/record.h>
 #include <sys/time.h>
 #include <signal.h>
 
@@ -22,19 +23,53 @@
 
 static alarm_handler_t handler[MAX_HANDLER] = {};
 static int idx = 0;
+static volatile sig_atomic_t alarm_pending = false;
 
 void add_alarm_handle(alarm_handler_t h) {
   assert(idx < MAX_HANDLER);
   handler[idx ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
+static void alarm_dispatch() {
   int i;
   for (i = 0; i < idx; i ++) {
     handler[i]();
   }
 }
 
+static void alarm_sig_handler(int signum) {
+  alarm_pending = true;
+}
+
+// Called after every instruction. The handlers are invoked here instead of
+// in the signal handler, so that they run between two instructions, where
+// the alarm can be recorded and replayed.
+void alarm_update() {
+#ifdef CONFIG_RECORD_REPLAY
+  if (record_replaying()) {
+    alarm_pending = false;
+    while (record_replay_alarm()) alarm_dispatch();
+    return;
+  }
+#endif
+  if (likely(!alarm_pending)) return;
+  alarm_pending = false;
+  IFDEF(CONFIG_RECORD_REPLAY, record_alarm());
+  alarm_dispatch();
+}
+
+// Called after the host thread sleeps for `us' while the guest is idle.
+// ITIMER_VIRTUAL only counts the CPU time of the process, so it does not
+// expire during the sleep, and the alarm is raised here for each period.
+void alarm_idle(uint64_t us) {
+  static uint64_t slept = 0;
+  slept += us;
+  if (slept >= 1000000 / TIMER_HZ) {
+    slept = 0;
+    alarm_pending = true;
+  }
+}
+
 void init_alarm() {
   struct sigaction s;
   memset(&s, 0, sizeof(s));
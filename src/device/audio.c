@@ -15,7 +15,9 @@
 
 #include <common.h>
 #include <device/map.h>
+#ifdef CONFIG_HAS_SDL
 #include <SDL2/SDL.h>
+#endif
 #include <stdint.h>
 
 enum {
@@ -28,30 +30,126 @@ enum {
   nr_reg
 };
 
+// sbuf is a ring shared by the guest, which produces the samples, and
+// the audio sink, which consumes them. The guest reads `count', waits
+// until there is enough space, writes its samples after the previous
+// ones (wrapping at the end of sbuf), then writes `count + len' back
+// to `count'. The two sides only share the running byte counts
+// `produced' and `consumed', each written by one side, so the audio
+// path needs no lock.
+// With SDL, the samples are consumed by the audio callback. With
+// --audio-wav, or without SDL, they are consumed as soon as `count' is
+// written, and appended to the WAV file if there is one.
+
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
-static uint32_t p __attribute__((unused)) = 0;
+static uint32_t produced = 0;   // written by the CPU thread
+static uint32_t consumed = 0;   // written by the consumer
+static uint32_t count_base = 0; // `consumed' when the guest read `count'
+static bool consumed_by_sdl = false;
+static const char *wav_file = NULL;
+static FILE *wav = NULL;
 
+void audio_set_wav(const char *file) {
+  wav_file = file;
+}
+
+// copy at most `len' bytes of samples to `buf', return the number of bytes copied
+static uint32_t audio_consume(uint8_t *buf, uint32_t len) {
+  uint32_t avail = __atomic_load_n(&produced, __ATOMIC_ACQUIRE) - consumed;
+  uint32_t n = (len < avail ? len : avail);
+  uint32_t pos = consumed % CONFIG_SB_SIZE;
+  uint32_t n1 = (n < CONFIG_SB_SIZE - pos ? n : CONFIG_SB_SIZE - pos);
+  memcpy(buf, sbuf + pos, n1);
+  memcpy(buf + n1, sbuf, n - n1);
+  __atomic_store_n(&consumed, consumed + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+#ifdef CONFIG_HAS_SDL
 static void audio_callback(void *userdata, Uint8 *stream, int len) {
+  uint32_t n = audio_consume(stream, len);
+  memset(stream + n, 0, len - n); // silence when the guest is late
+}
+#endif
+
+static void wav_header() {
+  uint16_t channels = audio_base[reg_channels];
+  uint32_t freq = audio_base[reg_freq];
+  uint32_t data_size = ftell(wav) - 44;
+  struct __attribute__((packed)) {
+    char riff[4]; uint32_t riff_size; char wave[4];
+    char fmt[4]; uint32_t fmt_size; uint16_t format, channels;
+    uint32_t freq, byte_rate; uint16_t block_align, bits;
+    char data[4]; uint32_t data_size;
+  } h = {
+    .riff = "RIFF", .riff_size = 36 + data_size, .wave = "WAVE",
+    .fmt = "fmt ", .fmt_size = 16, .format = 1, .channels = channels,
+    .freq = freq, .byte_rate = freq * channels * 2, .block_align = channels * 2, .bits = 16,
+    .data = "data", .data_size = data_size,
+  };
+  fseek(wav, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, wav);
+  fseek(wav, 0, SEEK_END);
+}
 
+static void audio_drain() {
+  uint8_t buf[4096];
+  uint32_t n;
+  while ((n = audio_consume(buf, sizeof(buf))) > 0) {
+    if (wav != NULL) fwrite(buf, n, 1, wav);
+  }
+}
+
+static void wav_close() {
+  audio_drain();
+  wav_header();
+  fclose(wav);
+  wav = NULL;
+}
+
+static void audio_init() {
+  if (wav_file != NULL) {
+    if (wav != NULL) return;
+    wav = fopen(wav_file, "wb");
+    Assert(wav, "Can not open '%s'", wav_file);
+    fseek(wav, 44, SEEK_SET);
+    wav_header();
+    atexit(wav_close);
+    return;
+  }
+#ifdef CONFIG_HAS_SDL
+  if (consumed_by_sdl) SDL_CloseAudio();
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_callback;
+  s.channels = audio_base[reg_channels];
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  consumed_by_sdl = (SDL_OpenAudio(&s, NULL) == 0);
+  if (consumed_by_sdl) SDL_PauseAudio(0);
+  else Log("Can not open audio: %s", SDL_GetError());
+#endif
 }
-//static void init_audio_spec() {
-//}
 
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
-  if (offset == 0x08 && is_write) {
-    SDL_AudioSpec s = {};
-    s.format = AUDIO_S16SYS;  
-    s.userdata = NULL;        
-    s.freq=audio_base[0];
-    s.samples=audio_base[2];
-    s.callback=audio_callback;
-    s.channels = audio_base[1];     
-    SDL_InitSubSystem(SDL_INIT_AUDIO);
-    SDL_OpenAudio(&s, NULL);
-    SDL_PauseAudio(0); 
-  } else if (offset == 0x14 && !is_write) {
-    //audio_base[5] = 
+  switch (offset / 4) {
+    case reg_init:
+      if (is_write) audio_init();
+      break;
+    case reg_count:
+      if (!is_write) {
+        count_base = __atomic_load_n(&consumed, __ATOMIC_ACQUIRE);
+        audio_base[reg_count] = produced - count_base;
+      } else if (audio_base[reg_count] <= CONFIG_SB_SIZE) {
+        // the samples written to sbuf are visible to the consumer after this
+        __atomic_store_n(&produced, count_base + audio_base[reg_count], __ATOMIC_RELEASE);
+        if (!consumed_by_sdl) audio_drain();
+      }
+      break;
+    default: break;
   }
 }
 
@@ -67,9 +165,7 @@ void init_audio() {
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
-  audio_base[3] = CONFIG_SB_SIZE;
-  audio_base[4] = 1;
-  audio_base[5] = 0;
-#ifdef CONFIG_HAS_AUDIO
-#endif
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
+  audio_base[reg_init] = 1;
+  audio_base[reg_count] = 0;
 }
@@ -0,0 +1,140 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <device/map.h>
+
+#ifdef CONFIG_HAS_CLINT
+// The core-local interruptor of SiFive, for hart 0 only. mtime is virtual
+// time, which advances once every CONFIG_CLINT_TICK_INST guest instructions,
+// so the timer interrupts are deterministic and can be recorded and replayed.
+// While the guest is idle, mtime is fast-forwarded by clint_idle().
+// The guest should use (its instructions per second / CONFIG_CLINT_TICK_INST)
+// as the timebase frequency.
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+extern uint64_t g_nr_guest_inst;
+
+static uint8_t *clint_base = NULL;
+static uint64_t mtime_skip = 0; // mtime - g_nr_guest_inst / CONFIG_CLINT_TICK_INST
+static uint64_t clint_deadline = -1; // g_nr_guest_inst when MTIP should be set
+
+static inline uint64_t* clint_reg(uint32_t offset) { return (uint64_t *)(clint_base + offset); }
+
+static uint64_t mtime() {
+  return g_nr_guest_inst / CONFIG_CLINT_TICK_INST + mtime_skip;
+}
+
+void clint_set_mip() {
+  uint64_t cmp = *clint_reg(CLINT_MTIMECMP);
+  word_t mip = cpu.mip & ~(MIP_MSIP | MIP_MTIP);
+  if (*(uint32_t *)(clint_base + CLINT_MSIP) & 1) mip |= MIP_MSIP;
+  if (mtime() >= cmp) {
+    mip |= MIP_MTIP;
+    clint_deadline = -1;
+  } else {
+    uint64_t ticks = cmp - mtime_skip;
+    clint_deadline = (ticks > UINT64_MAX / CONFIG_CLINT_TICK_INST ? -1 : ticks * CONFIG_CLINT_TICK_INST);
+  }
+  if (mip != cpu.mip) {
+    cpu.mip = mip;
+    g_intr_pending = true;
+  }
+}
+
+// called by device_update()
+void clint_update() {
+  if (likely(g_nr_guest_inst < clint_deadline)) return;
+  clint_set_mip();
+}
+
+#ifdef CONFIG_DEVICE_IDLE
+// The speed of the guest when it is busy, i.e. running in cpu_exec() but not
+// sleeping in device_idle(). Until enough instructions are counted, a
+// nominal speed is used.
+#define BUSY_MIN_INST 1000000
+#define NOMINAL_INST_PER_US 100
+static uint64_t busy_inst = 0, busy_us = 0;
+static uint64_t last_inst = 0, last_time = 0;
+
+// Skip the virtual time as far as the guest would go in `us' at its busy
+// speed, but not beyond the deadline, and return the time skipped. With
+// `exact', the time is skipped to the deadline at once instead, which does
+// not depend on the host and can be replayed, and 0 is returned if there
+// is a deadline.
+static uint64_t skip(uint64_t us, bool exact) {
+  uint64_t now = cpu_exec_time();
+  if (g_nr_guest_inst != last_inst) {
+    busy_inst += g_nr_guest_inst - last_inst;
+    busy_us += now - last_time;
+    last_inst = g_nr_guest_inst;
+  }
+  last_time = now;
+
+  // no deadline if mtimecmp is not set or already passed
+  uint64_t cmp = *clint_reg(CLINT_MTIMECMP);
+  uint64_t left = (cmp > mtime() && cmp != (uint64_t)-1 ? cmp - mtime() : -1);
+  uint64_t ticks;
+  if (exact) {
+    ticks = (left == (uint64_t)-1 ? 0 : left);
+    if (ticks > 0) us = 0;
+  } else {
+    double inst_per_us = (busy_inst < BUSY_MIN_INST || busy_us == 0 ?
+        NOMINAL_INST_PER_US : (double)busy_inst / busy_us);
+    ticks = us * inst_per_us / CONFIG_CLINT_TICK_INST;
+    if (left <= ticks) {
+      ticks = left;
+      us = left * CONFIG_CLINT_TICK_INST / inst_per_us;
+    }
+  }
+  mtime_skip += ticks;
+  clint_set_mip();
+  return us;
+}
+
+// Called by device_idle() before the host thread sleeps for the returned
+// time, which is not counted as busy.
+uint64_t clint_idle(uint64_t us, bool exact) {
+  us = skip(us, exact);
+  last_time += us;
+  return us;
+}
+
+// Called by device_poll(), where the guest does not sleep but sees the
+// time skipped at once.
+uint64_t clint_skip(uint64_t us) {
+  return skip(us, false);
+}
+#endif
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (!is_write) *clint_reg(CLINT_MTIME) = mtime();
+    else mtime_skip = *clint_reg(CLINT_MTIME) - g_nr_guest_inst / CONFIG_CLINT_TICK_INST;
+  }
+  if (is_write) clint_set_mip();
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+  *clint_reg(CLINT_MTIMECMP) = -1;
+}
+#endif
@@ -16,24 +16,48 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
-#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_HAS_SDL
 #include <SDL2/SDL.h>
 #endif
+#ifdef CONFIG_DEVICE_IDLE
+#include <device/record.h>
+#include <unistd.h>
+#endif
 
 void init_map();
 void init_serial();
 void init_timer();
+void init_clint();
+void init_plic();
 void init_vga();
 void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
 void init_alarm();
+void disk_update();
+void clint_update();
+void clint_set_mip();
+void plic_update();
+uint64_t clint_idle(uint64_t us, bool exact);
+uint64_t clint_skip(uint64_t us);
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+// cpu.mip is restored with the registers by reverse execution, but the
+// devices are not, so rebuild it from their state, which is the one the
+// guest sees again when the replay ends.
+void device_refresh_intr() {
+  IFDEF(CONFIG_HAS_CLINT, clint_set_mip());
+  IFDEF(CONFIG_HAS_PLIC, plic_update());
+}
+
 void device_update() {
+  IFNDEF(CONFIG_TARGET_AM, alarm_update());
+  IFDEF(CONFIG_HAS_DISK, disk_update());
+  IFDEF(CONFIG_HAS_CLINT, clint_update());
+
   static uint64_t last = 0;
   uint64_t now = get_time();
   if (now - last < 1000000 / TIMER_HZ) {
@@ -43,7 +67,7 @@ void device_update() {
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
-#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_HAS_SDL
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -66,8 +90,74 @@ void device_update() {
 #endif
 }
 
+#ifdef CONFIG_DEVICE_IDLE
+#define POLL_GAP_INST 256  // polls closer than this are in a tight loop
+#define POLL_THRESHOLD 1000
+#define POLL_SKIP_US 1000
+
+static uint64_t time_skip = 0; // us skipped by device_poll()
+
+// Host time can not be replayed, so while the guest must be deterministic,
+// the host thread does not wait in wfi.
+static bool idle_exact() {
+  return MUXDEF(CONFIG_RECORD_REPLAY, record_mode != RECORD_OFF, false) ||
+    MUXDEF(CONFIG_REVERSE_EXEC, true, false);
+}
+
+static void idle_sleep(uint64_t us) {
+  if (!idle_exact()) {
+    IFDEF(CONFIG_HAS_CLINT, us = clint_idle(us, false));
+  }
+  if (us > 0) {
+    usleep(us);
+    alarm_idle(us);
+  }
+}
+
+// Called by wfi until some interrupt is pending. Each call sleeps for at
+// most one alarm period, then updates the devices. While the guest must be
+// deterministic, the virtual time is only skipped to the timer deadline,
+// and false is returned, since the alarms can only be recorded and
+// replayed between instructions.
+bool device_idle() {
+  if (idle_exact()) {
+    IFDEF(CONFIG_HAS_CLINT, clint_idle(0, true));
+    return false;
+  }
+  idle_sleep(1000000 / TIMER_HZ);
+  device_update();
+  return true;
+}
+
+// Called by the RTC and the keyboard at each read. A guest polling them in
+// a tight loop is waiting for the time to pass, so after many polls with
+// few instructions in between, the time seen by the guest is skipped a
+// little before each poll. The CLINT is not skipped while the guest must
+// be deterministic, since its interrupts depend on the instruction count.
+void device_poll() {
+  extern uint64_t g_nr_guest_inst;
+  static uint64_t last = 0;
+  static int nr_poll = 0;
+  nr_poll = (g_nr_guest_inst - last < POLL_GAP_INST ? nr_poll + 1 : 0);
+  last = g_nr_guest_inst;
+  if (nr_poll >= POLL_THRESHOLD && !MUXDEF(CONFIG_RECORD_REPLAY, record_replaying(), false)) {
+    uint64_t us = POLL_SKIP_US;
+    if (!idle_exact()) {
+      IFDEF(CONFIG_HAS_CLINT, us = clint_skip(us));
+    }
+    time_skip += us;
+    alarm_idle(us);
+  }
+}
+
+// host time plus the time skipped, seen by the RTC
+uint64_t device_time() {
+  return get_time() + time_skip;
+}
+#endif
+
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_HAS_SDL
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -79,6 +169,8 @@ void init_device() {
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
   IFDEF(CONFIG_HAS_VGA, init_vga());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
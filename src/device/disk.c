@@ -14,6 +14,235 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <device/intr.h>
+#include <cpu/reverse.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <device/record.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A paravirtual block device. The guest puts requests in a ring in its
+// memory, writes DISK_RING_ADDR and DISK_RING_SIZE once, then writes the
+// index of the next free entry to DISK_SUBMIT after filling some entries.
+// Indices are free running, so entry `i' is at ring[i % ring_size]. The
+// requests are serviced in order by an I/O thread while the guest keeps
+// running. DISK_COMPLETE is the index after the last completed request,
+// and the `status' of a request is written before DISK_COMPLETE passes it.
+// Writing DISK_RING_SIZE resets the ring, and the guest should then
+// continue from the index read from DISK_SUBMIT.
+// If DISK_CTRL_IRQ is set, dev_raise_intr() is called after requests are
+// completed, and DISK_STATUS reads 1 until it is written.
+//
+// Requests are serviced synchronously when the guest must be deterministic,
+// i.e. while recording or replaying, with reverse execution, or when some
+// watchpoint is set.
+
+enum {
+  DISK_NR_SECTOR_LO, DISK_NR_SECTOR_HI, // capacity in 512-byte sectors
+  DISK_RING_ADDR, DISK_RING_SIZE,
+  DISK_SUBMIT, DISK_COMPLETE,
+  DISK_CTRL, DISK_STATUS,
+  NR_DISK_REG
+};
+
+#define DISK_CTRL_IRQ 0x1
+#define DISK_MAX_RING 256
+
+enum { DISK_OP_READ, DISK_OP_WRITE, DISK_OP_FLUSH };
+enum { DISK_OK, DISK_IOERR, DISK_UNSUPP, DISK_PENDING = 0xff };
+
+typedef struct {
+  uint32_t op;
+  uint32_t status;
+  uint64_t sector;
+  uint64_t addr;       // guest physical address of the buffer
+  uint32_t nr_sector;
+  uint32_t pad;
+} DiskReq;
+
+// a request checked by the CPU thread, ready for the I/O thread
+typedef struct {
+  uint32_t op;
+  uint32_t *status;    // in the guest ring
+  uint8_t *buf;        // in pmem, NULL if the request is invalid or empty
+  off_t off;
+  size_t len;
+  bool valid;          // the sectors are in the image and the buffer in pmem
+} DiskJob;
+
+static uint32_t *disk_base = NULL;
+static int fd = -1;
+static uint64_t nr_sector = 0;
+static DiskReq *ring = NULL;
+static uint32_t ring_size = 0;
+static uint32_t nr_submit = 0;
+
+static DiskJob jobs[DISK_MAX_RING];
+static uint32_t nr_queued = 0;  // written by the CPU thread
+static uint32_t nr_done = 0;    // written by the I/O thread
+static uint32_t nr_reported = 0; // completions seen by disk_update()
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_done = PTHREAD_COND_INITIALIZER;
+
+static uint32_t disk_do(DiskJob *j) {
+  if (j->op == DISK_OP_READ || j->op == DISK_OP_WRITE) {
+    if (!j->valid) return DISK_IOERR;
+    if (j->len == 0) return DISK_OK;
+  }
+  ssize_t n;
+  switch (j->op) {
+    case DISK_OP_READ:  n = pread(fd, j->buf, j->len, j->off); break;
+    case DISK_OP_WRITE: n = pwrite(fd, j->buf, j->len, j->off); break;
+    case DISK_OP_FLUSH: return fdatasync(fd) == 0 ? DISK_OK : DISK_IOERR;
+    default: return DISK_UNSUPP;
+  }
+  return n == (ssize_t)j->len ? DISK_OK : DISK_IOERR;
+}
+
+static void* disk_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (nr_done == nr_queued) pthread_cond_wait(&cond_queued, &lock);
+    DiskJob *j = &jobs[nr_done % DISK_MAX_RING];
+    pthread_mutex_unlock(&lock);
+
+    __atomic_store_n(j->status, disk_do(j), __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&nr_done, nr_done + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&cond_done);
+  }
+  return NULL;
+}
+
+static bool disk_sync() {
+  extern bool watchpoint_any();
+  return MUXDEF(CONFIG_RECORD_REPLAY, record_mode != RECORD_OFF, false) ||
+    MUXDEF(CONFIG_REVERSE_EXEC, true, false) || MUXDEF(CONFIG_WATCHPOINT, watchpoint_any(), false);
+}
+
+static void disk_submit(uint32_t idx) {
+  DiskReq *r = &ring[idx % ring_size];
+  DiskJob j = { .op = r->op, .status = &r->status, .buf = NULL,
+    .off = r->sector * 512, .len = (size_t)r->nr_sector * 512, .valid = false };
+  if (j.op == DISK_OP_READ || j.op == DISK_OP_WRITE) {
+    if (r->sector <= nr_sector && r->nr_sector <= nr_sector - r->sector) {
+      // paddr_dma() returns NULL for an empty range, which is still valid
+      if (j.len > 0) j.buf = paddr_dma(r->addr, j.len, j.op == DISK_OP_READ);
+      j.valid = (j.len == 0 || j.buf != NULL);
+    }
+  }
+  // the status is written by the device, let reverse execution and
+  // watchpoints see it
+  paddr_dma(host_to_guest((uint8_t *)&r->status), sizeof(r->status), true);
+  r->status = DISK_PENDING;
+
+  pthread_mutex_lock(&lock);
+  jobs[nr_queued % DISK_MAX_RING] = j;
+  nr_queued ++;
+  pthread_cond_signal(&cond_queued);
+  pthread_mutex_unlock(&lock);
+}
+
+#ifdef CONFIG_REVERSE_EXEC
+// The requests from `first' are completed. Log what they wrote to pmem,
+// since the disk is not run when the guest is replayed.
+static void disk_record(uint32_t first) {
+  for (uint32_t i = first; i != nr_queued; i ++) {
+    DiskJob *j = &jobs[i % DISK_MAX_RING];
+    if (j->op == DISK_OP_READ && j->buf != NULL) reverse_record_dma(j->buf, j->len);
+    reverse_record_dma((uint8_t *)j->status, sizeof(*j->status));
+  }
+}
+#endif
+
+// called by device_update() in the CPU thread
+void disk_update() {
+  uint32_t done = __atomic_load_n(&nr_done, __ATOMIC_ACQUIRE);
+  if (likely(done == nr_reported)) return;
+  nr_reported = done;
+  if (disk_base[DISK_CTRL] & DISK_CTRL_IRQ) {
+    disk_base[DISK_STATUS] = 1;
+    dev_raise_intr(IRQ_DISK);
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / 4) {
+    case DISK_RING_SIZE:
+      if (!is_write) break;
+      ring_size = disk_base[DISK_RING_SIZE];
+      ring = NULL;
+      if (ring_size > 0 && ring_size <= DISK_MAX_RING && (ring_size & (ring_size - 1)) == 0 &&
+          (disk_base[DISK_RING_ADDR] & 0x7) == 0) {
+        ring = (DiskReq *)paddr_dma(disk_base[DISK_RING_ADDR], ring_size * sizeof(DiskReq), true);
+      }
+      if (ring == NULL) ring_size = 0;
+      nr_submit = disk_base[DISK_SUBMIT] = disk_base[DISK_COMPLETE] = nr_queued;
+      break;
+    case DISK_SUBMIT: {
+      if (!is_write || ring == NULL) break;
+      uint32_t first __attribute__((unused)) = nr_queued;
+      // at most a whole ring can be in flight
+      while (nr_submit != disk_base[DISK_SUBMIT] &&
+          nr_submit - __atomic_load_n(&nr_done, __ATOMIC_ACQUIRE) < ring_size) {
+        disk_submit(nr_submit ++);
+      }
+      if (disk_sync()) {
+        pthread_mutex_lock(&lock);
+        while (nr_done != nr_queued) pthread_cond_wait(&cond_done, &lock);
+        pthread_mutex_unlock(&lock);
+        IFDEF(CONFIG_REVERSE_EXEC, disk_record(first));
+        disk_update();
+      }
+      break;
+    }
+    case DISK_COMPLETE:
+      if (!is_write) disk_base[DISK_COMPLETE] = __atomic_load_n(&nr_done, __ATOMIC_ACQUIRE);
+      break;
+    case DISK_STATUS:
+      if (is_write) disk_base[DISK_STATUS] = 0;
+      break;
+    default: break;
+  }
+}
+
+void init_disk() {
+  disk_base = (uint32_t *)new_space(NR_DISK_REG * 4);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, NR_DISK_REG * 4, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, NR_DISK_REG * 4, disk_io_handler);
+#endif
+
+  // without an image, all the reads and writes fail with DISK_IOERR
+  pthread_t thread;
+  Assert(pthread_create(&thread, NULL, disk_thread, NULL) == 0, "Can not create the disk thread");
+  pthread_detach(thread);
+
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] == '\0') return;
+  fd = open(path, O_RDWR);
+  if (fd < 0) {
+    Log("Can not open disk image: %s", path);
+    return;
+  }
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat disk image: %s", path);
+  nr_sector = st.st_size / 512;
+  disk_base[DISK_NR_SECTOR_LO] = nr_sector;
+  disk_base[DISK_NR_SECTOR_HI] = nr_sector >> 32;
+  Log("Disk image %s, %" PRIu64 " sectors", path, nr_sector);
+}
+#else
+void disk_update() {
+}
 
 void init_disk() {
 }
+#endif
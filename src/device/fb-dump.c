@@ -0,0 +1,266 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <device/alarm.h>
+
+#ifdef CONFIG_VGA_FB_DUMP
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+// The frames synced by the guest are written by --fb-dump=PATH:
+//   PATH ending with .y4m  a Y4M (4:4:4) video stream in the file
+//   PATH starting with |   a Y4M stream piped to the command, e.g.
+//                          '|ffmpeg -i - out.mp4'
+//   otherwise              one PNG per frame in the directory PATH,
+//                          named frame-000000.png, frame-000001.png, ...
+// The CPU thread only copies the frame into a queue, and the frames are
+// hashed and encoded by an I/O thread. A frame identical to the previous
+// one is skipped, so an idle screen produces a single frame. If the queue
+// is full, the frame is dropped rather than stalling the guest.
+
+#define NR_QUEUE 4
+
+static const char *dump_path = NULL;
+static FILE *stream = NULL;
+static bool is_pipe = false;
+static int width = 0, height = 0;
+
+static uint32_t *queue[NR_QUEUE] = {};
+static uint32_t nr_queued = 0;  // written by the CPU thread
+static uint32_t nr_done = 0;    // written by the I/O thread
+static uint64_t nr_written = 0, nr_dropped = 0;
+static bool failed = false;     // set by the I/O thread on a write error
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_done = PTHREAD_COND_INITIALIZER;
+
+void vga_set_fb_dump(const char *path) {
+  dump_path = path;
+}
+
+static uint64_t frame_hash(const uint32_t *frame) {
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int i = 0; i < width * height; i ++) {
+    h = (h ^ frame[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *p, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i ++) crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint8_t* put_be32(uint8_t *p, uint32_t x) {
+  p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+  return p + 4;
+}
+
+// `data' of a chunk starts 8 bytes after `p', and its crc is appended
+static uint8_t* put_chunk(uint8_t *p, const char *type, uint32_t len) {
+  put_be32(p, len);
+  memcpy(p + 4, type, 4);
+  return put_be32(p + 8 + len, crc32(0, p + 4, len + 4));
+}
+
+// The image data is stored without compression, so no zlib is needed.
+// The files are larger, but CI only compares their pixels.
+// return false on a write error
+static bool write_png(const uint32_t *frame) {
+  size_t raw_len = (size_t)(width * 3 + 1) * height;
+  size_t nr_block = (raw_len + 0xffff - 1) / 0xffff;
+  size_t idat_len = 2 + raw_len + nr_block * 5 + 4;
+  uint8_t *png = malloc(8 + 25 + 12 + idat_len + 12);
+  assert(png);
+
+  uint8_t *p = png;
+  memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+  p += 8;
+  uint8_t *d = p + 8;
+  d = put_be32(d, width);
+  d = put_be32(d, height);
+  memcpy(d, "\x08\x02\x00\x00\x00", 5); // 8-bit RGB
+  p = put_chunk(p, "IHDR", 13);
+
+  // zlib stream of stored deflate blocks, over rows of (filter 0, RGB...)
+  d = p + 8;
+  *d ++ = 0x78; *d ++ = 0x01;
+  uint32_t a = 1, b = 0; // adler32
+  size_t left = raw_len, block_left = 0;
+  for (int y = 0; y < height; y ++) {
+    for (int x = -1; x < width; x ++) {
+      uint8_t px[3] = { 0 }; // the filter byte for x == -1
+      int n = 1;
+      if (x >= 0) {
+        uint32_t c = frame[y * width + x];
+        px[0] = c >> 16; px[1] = c >> 8; px[2] = c;
+        n = 3;
+      }
+      for (int i = 0; i < n; i ++) {
+        if (block_left == 0) {
+          block_left = left < 0xffff ? left : 0xffff;
+          *d ++ = (left == block_left);
+          *d ++ = block_left; *d ++ = block_left >> 8;
+          *d ++ = ~block_left; *d ++ = ~block_left >> 8;
+        }
+        *d ++ = px[i];
+        a = (a + px[i]) % 65521;
+        b = (b + a) % 65521;
+        block_left --;
+        left --;
+      }
+    }
+  }
+  put_be32(d, (b << 16) | a);
+  p = put_chunk(p, "IDAT", idat_len);
+  p = put_chunk(p, "IEND", 0);
+
+  // written to a temporary file first, so a reader never sees a partial frame
+  char file[PATH_MAX], tmp[PATH_MAX + 8];
+  snprintf(file, sizeof(file), "%s/frame-%06" PRIu64 ".png", dump_path, nr_written);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  FILE *fp = fopen(tmp, "wb");
+  bool ok = (fp != NULL);
+  if (ok) {
+    ok = (fwrite(png, p - png, 1, fp) == 1);
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && (rename(tmp, file) == 0);
+  }
+  if (!ok) Log("Can not write '%s': %s", file, strerror(errno));
+  free(png);
+  return ok;
+}
+
+// return false on a write error
+static bool write_y4m(const uint32_t *frame) {
+  int n = width * height;
+  uint8_t *yuv = malloc(n * 3);
+  assert(yuv);
+  for (int i = 0; i < n; i ++) {
+    int r = (frame[i] >> 16) & 0xff, g = (frame[i] >> 8) & 0xff, b = frame[i] & 0xff;
+    // BT.601, limited range
+    yuv[i]         = ((  66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+    yuv[i + n]     = (( -38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+    yuv[i + n * 2] = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+  }
+  bool ok = (fputs("FRAME\n", stream) >= 0 && fwrite(yuv, n * 3, 1, stream) == 1);
+  if (!ok) Log("Can not write to %s: %s", dump_path, strerror(errno));
+  free(yuv);
+  return ok;
+}
+
+static void* fb_dump_thread(void *arg) {
+  uint64_t last_hash = 0;
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (nr_done == nr_queued) pthread_cond_wait(&cond_queued, &lock);
+    uint32_t *frame = queue[nr_done % NR_QUEUE];
+    pthread_mutex_unlock(&lock);
+
+    // after a write error, the frames are only drained so the guest goes on
+    uint64_t h = (failed ? 0 : frame_hash(frame));
+    if (!failed && (nr_written == 0 || h != last_hash)) {
+      bool ok = (stream != NULL ? write_y4m(frame) : write_png(frame));
+      if (ok) nr_written ++;
+      else {
+        Log("Stop dumping frames");
+        __atomic_store_n(&failed, true, __ATOMIC_RELAXED);
+      }
+      last_hash = h;
+    }
+
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&nr_done, nr_done + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&cond_done);
+  }
+  return NULL;
+}
+
+// called by the CPU thread at each sync which changed the screen
+void fb_dump_frame(const void *vmem) {
+  if (__atomic_load_n(&failed, __ATOMIC_RELAXED)) return;
+  if (nr_queued - __atomic_load_n(&nr_done, __ATOMIC_ACQUIRE) == NR_QUEUE) {
+    nr_dropped ++;
+    return;
+  }
+  memcpy(queue[nr_queued % NR_QUEUE], vmem, width * height * sizeof(uint32_t));
+  pthread_mutex_lock(&lock);
+  nr_queued ++;
+  pthread_cond_signal(&cond_queued);
+  pthread_mutex_unlock(&lock);
+}
+
+// wait for the queued frames before exiting
+void fb_dump_finish() {
+  pthread_mutex_lock(&lock);
+  while (nr_done != nr_queued) pthread_cond_wait(&cond_done, &lock);
+  pthread_mutex_unlock(&lock);
+  if (stream != NULL) {
+    if (is_pipe) pclose(stream);
+    else fclose(stream);
+    stream = NULL;
+  }
+  Log("%" PRIu64 " frames are dumped to %s, %" PRIu64 " frames are dropped",
+      nr_written, dump_path, nr_dropped);
+}
+
+// return false if --fb-dump is not given
+bool init_fb_dump(int w, int h) {
+  if (dump_path == NULL) return false;
+  width = w;
+  height = h;
+
+  size_t len = strlen(dump_path);
+  if (dump_path[0] == '|') {
+    stream = popen(dump_path + 1, "w");
+    is_pipe = true;
+    // if the command exits, the write fails instead of killing NEMU
+    signal(SIGPIPE, SIG_IGN);
+    Assert(stream, "Can not run '%s'", dump_path + 1);
+  } else if (len >= 4 && strcmp(dump_path + len - 4, ".y4m") == 0) {
+    stream = fopen(dump_path, "wb");
+    Assert(stream, "Can not open '%s'", dump_path);
+  } else {
+    Assert(mkdir(dump_path, 0755) == 0 || errno == EEXIST, "Can not create '%s'", dump_path);
+  }
+  if (stream != NULL) {
+    fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, TIMER_HZ);
+  }
+
+  for (uint32_t i = 0; i < 256; i ++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k ++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+  for (int i = 0; i < NR_QUEUE; i ++) {
+    queue[i] = malloc(w * h * sizeof(uint32_t));
+    assert(queue[i]);
+  }
+
+  pthread_t thread;
+  Assert(pthread_create(&thread, NULL, fb_dump_thread, NULL) == 0, "Can not create the fb-dump thread");
+  pthread_detach(thread);
+  Log("Frames are dumped to %s", dump_path);
+  return true;
+}
+#endif
@@ -14,6 +14,12 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/intr.h>
 
-void dev_raise_intr() {
+void plic_raise(int irq);
+
+// Without a PLIC, the interrupts of the devices are not connected.
+void dev_raise_intr(int irq) {
+  assert(irq > 0 && irq < NR_IRQ);
+  IFDEF(CONFIG_HAS_PLIC, plic_raise(irq));
 }
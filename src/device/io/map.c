@@ -17,6 +17,8 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#include <cpu/reverse.h>
+#include <device/record.h>
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
@@ -56,11 +58,18 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_STATS, map->nr_read ++);
 #ifdef CONFIG_DTRACE
   printf("[%.3lu] [%s] [Read] [0x%x] [%d bytes]\n", get_time(), map->name, addr, len);
+#endif
+#ifdef CONFIG_REVERSE_EXEC
+  // device reads are replayed from the log, without touching the device
+  if (reverse_replaying()) return reverse_replay_input();
 #endif
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_RECORD_REPLAY, ret = record_input(addr, ret));
+  reverse_record_input(ret);
   return ret;
 }
 
@@ -68,9 +77,12 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_STATS, map->nr_write ++);
 #ifdef CONFIG_DTRACE
   printf("[%.3lu] [%s] [Write] [0x%x] [%d bytes]\n", get_time(), map->name, addr, len);
 #endif
   host_write(map->space + offset, len, data);
+  // the device has already seen this write before the guest went back
+  if (reverse_replaying()) { IFDEF(CONFIG_REVERSE_EXEC, reverse_replay_dma()); return; }
   invoke_callback(map->callback, offset, len, true);
 }
@@ -18,7 +18,7 @@
 
 #define KEYDOWN_MASK 0x8000
 
-#ifndef CONFIG_TARGET_AM
+#ifdef CONFIG_HAS_SDL
 #include <SDL2/SDL.h>
 
 // Note that this is not the standard
@@ -70,7 +70,7 @@ void send_key(uint8_t scancode, bool is_keydown) {
     key_enqueue(am_scancode);
   }
 }
-#else // !CONFIG_TARGET_AM
+#elif defined(CONFIG_TARGET_AM)
 #define NEMU_KEY_NONE 0
 
 static uint32_t key_dequeue() {
@@ -78,13 +78,23 @@ static uint32_t key_dequeue() {
   uint32_t am_scancode = ev.keycode | (ev.keydown ? KEYDOWN_MASK : 0);
   return am_scancode;
 }
+#else // CONFIG_DEVICE_HEADLESS
+#define NEMU_KEY_NONE 0
+
+// no key is ever pressed without SDL
+static uint32_t key_dequeue() {
+  return NEMU_KEY_NONE;
+}
 #endif
 
 static uint32_t *i8042_data_port_base = NULL;
 
+void device_poll();
+
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
+  IFDEF(CONFIG_DEVICE_IDLE, device_poll());
   i8042_data_port_base[0] = key_dequeue();
 }
 
@@ -96,5 +106,5 @@ void init_i8042() {
 #else
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFDEF(CONFIG_HAS_SDL, init_keymap());
 }
@@ -0,0 +1,82 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <device/map.h>
+#include <device/intr.h>
+
+#ifdef CONFIG_HAS_PLIC
+// The platform-level interrupt controller of SiFive, with the sources of
+// device/intr.h and a single context, i.e. the M-mode of hart 0. The
+// interrupts of the devices are edge-triggered: a source is pending after
+// it is raised, until it is claimed.
+
+#define PLIC_PRIORITY  0x000000
+#define PLIC_PENDING   0x001000
+#define PLIC_ENABLE    0x002000
+#define PLIC_THRESHOLD 0x200000
+#define PLIC_CLAIM     0x200004
+#define PLIC_SIZE      0x200008
+
+static uint8_t *plic_base = NULL;
+static uint32_t pending = 0;
+
+static inline uint32_t* plic_reg(uint32_t offset) { return (uint32_t *)(plic_base + offset); }
+
+// the enabled pending source with the highest priority above the threshold, or 0
+static int plic_best() {
+  uint32_t cand = pending & *plic_reg(PLIC_ENABLE);
+  uint32_t best_prio = *plic_reg(PLIC_THRESHOLD);
+  int best = 0;
+  for (int i = 1; i < NR_IRQ; i ++) {
+    uint32_t prio = *plic_reg(PLIC_PRIORITY + i * 4);
+    if ((cand & (1u << i)) && prio > best_prio) {
+      best = i;
+      best_prio = prio;
+    }
+  }
+  return best;
+}
+
+void plic_update() {
+  *plic_reg(PLIC_PENDING) = pending;
+  word_t mip = (cpu.mip & ~MIP_MEIP) | (plic_best() != 0 ? MIP_MEIP : 0);
+  if (mip != cpu.mip) {
+    cpu.mip = mip;
+    g_intr_pending = true;
+  }
+}
+
+void plic_raise(int irq) {
+  pending |= 1u << irq;
+  plic_update();
+}
+
+static void plic_io_handler(uint32_t offset, int len, bool is_write) {
+  if (offset == PLIC_CLAIM && !is_write) {
+    int id = plic_best();
+    *plic_reg(PLIC_CLAIM) = id;
+    pending &= ~(1u << id);
+  }
+  // a completion needs nothing, and the other writes may change MEIP
+  if (offset == PLIC_CLAIM || is_write) plic_update();
+}
+
+void init_plic() {
+  plic_base = new_space(PLIC_SIZE);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, plic_base, PLIC_SIZE, plic_io_handler);
+}
+#endif
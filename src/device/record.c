@@ -0,0 +1,116 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/record.h>
+#include <device/alarm.h>
+
+// Everything non-deterministic the guest can observe comes from devices:
+// the values returned by device reads (rtc, i8042, audio count, ...) and the
+// alarm which raises timer interrupts. With --record=FILE they are logged
+// together with the number of instructions executed so far, and with
+// --replay=FILE they are fed back at the same points, so that the guest
+// executes exactly the same instructions again.
+
+enum { REC_READ, REC_ALARM };
+
+typedef struct {
+  uint64_t nr_inst;
+  uint64_t val;
+  uint32_t type;
+  uint32_t addr;
+} Record;
+
+static const char magic[8] = "NEMUREC1";
+
+extern uint64_t g_nr_guest_inst;
+
+int record_mode = RECORD_OFF;
+static FILE *fp = NULL;
+static Record next = {}; // next record to replay
+static bool has_next = false;
+
+static void put_record(uint32_t type, paddr_t addr, word_t val) {
+  Record r = { .nr_inst = g_nr_guest_inst, .val = val, .type = type, .addr = addr };
+  int ret = fwrite(&r, sizeof(r), 1, fp);
+  assert(ret == 1);
+}
+
+static void fetch_next() {
+  has_next = (fread(&next, sizeof(next), 1, fp) == 1);
+}
+
+word_t record_input(paddr_t addr, word_t val) {
+  switch (record_mode) {
+    case RECORD_ON: put_record(REC_READ, addr, val); return val;
+    case REPLAY_ON:
+      // the alarm may be delayed by a stop of the guest, see alarm_update()
+      while (has_next && next.type == REC_ALARM) {
+        Assert(next.nr_inst <= g_nr_guest_inst,
+            "replay diverges: expect an alarm after %" PRIu64 " instructions, "
+            "but read " FMT_PADDR " after %" PRIu64 " instructions",
+            next.nr_inst, addr, g_nr_guest_inst);
+        alarm_update();
+      }
+      Assert(has_next, "reach the end of the replay log at pc = " FMT_WORD, cpu.pc);
+      Assert(next.nr_inst == g_nr_guest_inst && next.addr == addr,
+          "replay diverges: expect reading " FMT_PADDR " after %" PRIu64 " instructions, "
+          "but read " FMT_PADDR " after %" PRIu64 " instructions",
+          (paddr_t)next.addr, next.nr_inst, addr, g_nr_guest_inst);
+      val = next.val;
+      fetch_next();
+      return val;
+    default: return val;
+  }
+}
+
+void record_alarm() {
+  if (record_mode == RECORD_ON) put_record(REC_ALARM, 0, 0);
+}
+
+// Called on the abort path, where the buffered records would be lost.
+void record_flush() {
+  if (record_mode == RECORD_ON) fflush(fp);
+}
+
+// Return true if an alarm is recorded no later than now.
+bool record_replay_alarm() {
+  if (has_next && next.type == REC_ALARM && next.nr_inst <= g_nr_guest_inst) {
+    fetch_next();
+    return true;
+  }
+  return false;
+}
+
+void init_record(const char *record_file, const char *replay_file) {
+  Assert(record_file == NULL || replay_file == NULL, "can not record and replay at the same time");
+  if (record_file != NULL) {
+    fp = fopen(record_file, "wb");
+    Assert(fp, "Can not open '%s'", record_file);
+    int ret = fwrite(magic, sizeof(magic), 1, fp);
+    assert(ret == 1);
+    record_mode = RECORD_ON;
+    Log("Record device inputs to %s", record_file);
+  } else if (replay_file != NULL) {
+    fp = fopen(replay_file, "rb");
+    Assert(fp, "Can not open '%s'", replay_file);
+    char buf[sizeof(magic)];
+    Assert(fread(buf, sizeof(buf), 1, fp) == 1 && memcmp(buf, magic, sizeof(magic)) == 0,
+        "%s is not a record of device inputs", replay_file);
+    record_mode = REPLAY_ON;
+    fetch_next();
+    Log("Replay device inputs from %s", replay_file);
+  }
+}
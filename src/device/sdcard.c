@@ -14,6 +14,13 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <device/intr.h>
+#include <cpu/reverse.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +35,17 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
-// right after sending the actual read/write commands.
+// The driver must be modified to start the transfer right after sending the
+// actual read/write commands. Data can be transferred by PIO through SDDATA,
+// or by DMA: the driver writes the guest physical address and the number of
+// blocks to SDDMAADDR and SDDMACNT, then writes SDDMA_START to SDDMACTL.
+// The whole transfer is done by a single memcpy() before the write returns.
+// If SDDMA_IRQ is also set, dev_raise_intr() is called on completion.
+
+#define SDDMA_START 0x1
+#define SDDMA_IRQ   0x2
+#define SDDMA_DONE  0x4
+#define SDDMA_ERROR 0x8
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,10 +53,16 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, __PAD14, __PAD15, __PAD16,
+  SDDMAADDR, SDDMACNT, SDDMACTL
 };
 
-static FILE *fp = NULL;
+// Without CONFIG_SDCARD_COW, the image is mapped with MAP_SHARED, so
+// writes go to the file directly. Otherwise it is mapped with MAP_PRIVATE,
+// and the written pages are copied by the host kernel, so many instances
+// can share one base image in the page cache.
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
@@ -51,8 +73,149 @@ static bool read_ext_csd = false;
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  if (!is_write && img != NULL && blkcnt > 0) {
+    // read ahead the blocks announced by MMC_SET_BLOCK_COUNT
+    uint64_t off = (uint64_t)blk_addr << 9, len = (uint64_t)blkcnt << 9;
+    if (off < img_size) {
+      uint64_t start = off & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+      uint64_t end = (off + len < img_size ? off + len : img_size);
+      madvise(img + start, end - start, MADV_WILLNEED);
+    }
+  }
+}
+
+#ifdef CONFIG_SDCARD_COW
+// A persistent overlay is a sparse file with a bitmap of the written
+// blocks, followed by the written blocks at their offsets in the image.
+// The blocks in the overlay are applied to the private mapping of the base
+// image at startup, and each write is also written through to the overlay.
+
+#define OVERLAY_MAGIC "NEMUCOW1"
+
+typedef struct {
+  char magic[8];
+  uint64_t img_size;
+  uint64_t bitmap_off;
+  uint64_t data_off;
+} OverlayHeader;
+
+static const char *overlay_file = NULL;
+static OverlayHeader *overlay = NULL;
+
+void sdcard_set_overlay(const char *file) {
+  overlay_file = file;
+}
+
+static inline uint8_t* overlay_bitmap() { return (uint8_t *)overlay + overlay->bitmap_off; }
+static inline uint8_t* overlay_data() { return (uint8_t *)overlay + overlay->data_off; }
+
+static void overlay_write(uint64_t off, uint32_t len) {
+  uint8_t *bitmap = overlay_bitmap();
+  for (uint64_t blk = off >> 9; blk <= (off + len - 1) >> 9; blk ++) {
+    uint64_t lo = blk << 9, hi = lo + 512;
+    if (!(bitmap[blk / 8] & (1 << (blk % 8)))) {
+      // the whole block is valid in the overlay after its first write
+      memcpy(overlay_data() + lo, img + lo, (hi < img_size ? hi : img_size) - lo);
+      bitmap[blk / 8] |= 1 << (blk % 8);
+    } else {
+      if (lo < off) lo = off;
+      if (hi > off + len) hi = off + len;
+      memcpy(overlay_data() + lo, img + lo, hi - lo);
+    }
+  }
+}
+
+static void init_overlay() {
+  uint64_t nr_blk = (img_size + 511) >> 9;
+  uint64_t bitmap_off = 4096, data_off = ROUNDUP(bitmap_off + (nr_blk + 7) / 8, 4096);
+  uint64_t size = data_off + img_size;
+
+  int fd = open(overlay_file, O_RDWR | O_CREAT, 0644);
+  Assert(fd >= 0, "Can not open sdcard overlay: %s", overlay_file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat sdcard overlay: %s", overlay_file);
+  bool is_new = (st.st_size == 0);
+  // the file is sparse, so only the written blocks take space on the disk
+  if (is_new) Assert(ftruncate(fd, size) == 0, "Can not resize sdcard overlay: %s", overlay_file);
+  else Assert(st.st_size == size, "The size of %s does not match the sdcard image", overlay_file);
+  overlay = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(overlay != MAP_FAILED, "Can not map sdcard overlay: %s", overlay_file);
+  close(fd);
+
+  if (is_new) {
+    overlay->img_size = img_size;
+    overlay->bitmap_off = bitmap_off;
+    overlay->data_off = data_off;
+    memcpy(overlay->magic, OVERLAY_MAGIC, sizeof(overlay->magic));
+    Log("Create sdcard overlay %s", overlay_file);
+    return;
+  }
+
+  Assert(memcmp(overlay->magic, OVERLAY_MAGIC, sizeof(overlay->magic)) == 0 &&
+      overlay->img_size == img_size && overlay->bitmap_off == bitmap_off &&
+      overlay->data_off == data_off, "%s is not an overlay of the sdcard image", overlay_file);
+  uint8_t *bitmap = overlay_bitmap();
+  uint64_t nr_apply = 0;
+  for (uint64_t blk = 0; blk < nr_blk; blk ++) {
+    if (bitmap[blk / 8] == 0) { blk |= 7; continue; }
+    if (bitmap[blk / 8] & (1 << (blk % 8))) {
+      uint64_t lo = blk << 9;
+      memcpy(img + lo, overlay_data() + lo, (lo + 512 < img_size ? lo + 512 : img_size) - lo);
+      nr_apply ++;
+    }
+  }
+  Log("Apply %" PRIu64 " blocks from sdcard overlay %s", nr_apply, overlay_file);
+}
+#endif
+
+// copy `len' bytes between the current position of the transfer and `buf'
+static void sdcard_rw(void *buf, uint32_t len) {
+  uint64_t off = ((uint64_t)blk_addr << 9) + addr;
+  uint32_t n = (off >= img_size ? 0 : off + len > img_size ? img_size - off : len);
+  if (write_cmd) {
+    if (n > 0) {
+      memcpy(img + off, buf, n);
+      IFDEF(CONFIG_SDCARD_COW, if (overlay) overlay_write(off, n));
+    }
+  }
+  else {
+    if (n > 0) memcpy(buf, img + off, n);
+    memset((uint8_t *)buf + n, 0, len - n);
+  }
+  addr += len;
+}
+
+// See section 8.1 JEDEC Standard JED84-A441
+static uint32_t ext_csd_read(uint32_t off) {
+  switch (off) {
+    case 192: return 2; // EXT_CSD_REV
+    case 212: return MEMORY_SIZE / 512;
+    default: return 0;
+  }
+}
+
+static void sdcard_dma() {
+  uint32_t len = (base[SDDMACNT] & 0xffff) << 9;
+  bool to_pmem = read_ext_csd || !write_cmd;
+  uint8_t *buf = paddr_dma(base[SDDMAADDR], len, to_pmem);
+  if (buf == NULL) {
+    base[SDDMACTL] = SDDMA_ERROR;
+    return;
+  }
+  if (read_ext_csd) {
+    for (uint32_t i = 0; i < len; i += 4) {
+      uint32_t data = ext_csd_read(i);
+      memcpy(buf + i, &data, 4);
+    }
+    read_ext_csd = false;
+  } else {
+    sdcard_rw(buf, len);
+  }
+  if (to_pmem) reverse_record_dma(buf, len);
+  bool irq = base[SDDMACTL] & SDDMA_IRQ;
+  base[SDDMACTL] = SDDMA_DONE;
+  if (irq) dev_raise_intr(IRQ_SDCARD);
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -100,22 +263,19 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
       break;
     case SDDATA:
        if (read_ext_csd) {
-         // See section 8.1 JEDEC Standard JED84-A441
-         uint32_t data;
-         switch (addr) {
-           case 192: data = 2; break; // EXT_CSD_REV
-           case 212: data = MEMORY_SIZE / 512; break;
-           default: data = 0;
-         }
-         base[SDDATA] = data;
+         base[SDDATA] = ext_csd_read(addr);
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+         addr += 4;
+       } else {
+         sdcard_rw(&base[SDDATA], 4);
        }
-       addr += 4;
        break;
+    case SDDMAADDR:
+    case SDDMACNT:
+      break;
+    case SDDMACTL:
+      if (is_write && (base[SDDMACTL] & SDDMA_START)) sdcard_dma();
+      break;
     default:
       Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
       panic("unhandle offset = %d", offset);
@@ -128,7 +288,24 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, MUXDEF(CONFIG_SDCARD_COW, O_RDONLY, O_RDWR));
+  if (fd < 0) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat sdcard image: %s", path);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE,
+        MUXDEF(CONFIG_SDCARD_COW, MAP_PRIVATE, MAP_SHARED), fd, 0);
+    Assert(img != MAP_FAILED, "Can not map sdcard image: %s", path);
+  }
+  close(fd);
+
+#ifdef CONFIG_SDCARD_COW
+  if (overlay_file != NULL && img_size > 0) init_overlay();
+  else Log("Writes to sdcard image %s are discarded on exit", path);
+#endif
 }
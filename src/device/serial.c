@@ -20,23 +20,104 @@
 // NOTE: this is compatible to 16550
 
 #define CH_OFFSET 0
+#define LCR_OFFSET 3
+#define LSR_OFFSET 5
+
+#define LCR_DLAB 0x80 // offset 0 and 1 are the divisor latch
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+#include <device/alarm.h>
+#include <unistd.h>
+
+// The output is buffered, and written to the host stderr when a line is
+// complete, when the buffer is full, at each alarm, when the CPU stops,
+// and at exit. So a chatty guest costs one write() per line rather than
+// one per character.
+static char obuf[4096];
+static int olen = 0;
+
+void serial_flush() {
+  for (int i = 0; i < olen; ) {
+    int n = write(STDERR_FILENO, obuf + i, olen - i);
+    if (n <= 0) break;
+    i += n;
+  }
+  olen = 0;
+}
+
+static void serial_putc(char ch) {
+  obuf[olen ++] = ch;
+  if (ch == '\n' || olen == sizeof(obuf)) serial_flush();
+}
+#else
+void serial_flush() {
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  putch(ch);
 }
+#endif
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// The input is read from the named pipe /tmp/nemu.serial, e.g. with
+// `cat > /tmp/nemu.serial'. The pipe is never waited for: LSR_DR is only
+// set when a byte has already arrived.
+#define SERIAL_FIFO "/tmp/nemu.serial"
+
+static int fifo_fd = -1;
+static uint8_t ibuf[256];
+static int ihead = 0, itail = 0;
+
+static bool serial_rx_ready() {
+  if (ihead == itail && fifo_fd >= 0) {
+    int n = read(fifo_fd, ibuf, sizeof(ibuf));
+    ihead = 0;
+    itail = (n > 0 ? n : 0);
+  }
+  return ihead != itail;
+}
+
+static uint8_t serial_getc() {
+  return serial_rx_ready() ? ibuf[ihead ++] : 0;
+}
+
+static void init_fifo() {
+  if (mkfifo(SERIAL_FIFO, 0666) != 0) {
+    struct stat st;
+    Assert(stat(SERIAL_FIFO, &st) == 0 && S_ISFIFO(st.st_mode), "%s is not a named pipe", SERIAL_FIFO);
+  }
+  // a non-blocking open for reading succeeds without any writer
+  fifo_fd = open(SERIAL_FIFO, O_RDONLY | O_NONBLOCK);
+  Assert(fifo_fd >= 0, "Can not open %s", SERIAL_FIFO);
+  Log("Serial input is read from %s", SERIAL_FIFO);
+}
+#else
+static bool serial_rx_ready() { return false; }
+static uint8_t serial_getc() { return 0; }
+#endif
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
+      if (serial_base[LCR_OFFSET] & LCR_DLAB) break;
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = serial_getc();
       break;
-    default: panic("do not support offset = %d", offset);
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (serial_rx_ready() ? LSR_DR : 0);
+      break;
+    // the other registers only keep their values
+    default: break;
   }
 }
 
@@ -47,5 +128,10 @@ void init_serial() {
 #else
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
-
+  serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT;
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
+#ifndef CONFIG_TARGET_AM
+  add_alarm_handle(serial_flush);
+  atexit(serial_flush);
+#endif
 }
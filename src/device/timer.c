@@ -15,14 +15,19 @@
 
 #include <device/map.h>
 #include <device/alarm.h>
+#include <device/intr.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+void device_poll();
+uint64_t device_time();
+
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    IFDEF(CONFIG_DEVICE_IDLE, device_poll());
+    uint64_t us = MUXDEF(CONFIG_DEVICE_IDLE, device_time(), get_time());
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
@@ -31,8 +36,7 @@ static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
 #ifndef CONFIG_TARGET_AM
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
+    dev_raise_intr(IRQ_RTC);
   }
 }
 #endif
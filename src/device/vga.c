@@ -34,6 +34,33 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+// Writes to vmem mark their scanlines dirty, and only the dirty scanlines
+// are uploaded at the next sync. Nothing is presented if no pixel changed.
+static uint32_t pitch = 0;
+static bool *dirty_line = NULL;
+static bool screen_dirty = false;
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  dirty_line[offset / pitch] = dirty_line[(offset + len - 1) / pitch] = true;
+  screen_dirty = true;
+}
+
+// call `upload(y, h)' for every run of dirty scanlines and clean them,
+// return false if the screen did not change since the last call
+static bool flush_dirty(void (*upload)(int y, int h)) {
+  if (!screen_dirty) return false;
+  int h = screen_height();
+  for (int y = 0; y < h; y ++) {
+    if (!dirty_line[y]) continue;
+    int y0 = y;
+    while (y < h && dirty_line[y]) dirty_line[y ++] = false;
+    if (upload != NULL) upload(y0, y - y0);
+  }
+  screen_dirty = false;
+  return true;
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
@@ -56,8 +83,13 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
+static void upload_lines(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint8_t *)vmem + y * pitch, pitch);
+}
+
 static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+  if (!flush_dirty(upload_lines)) return;
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,14 +97,31 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
+static void upload_lines(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint8_t *)vmem + y * pitch, screen_width(), h, false);
+}
+
 static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+  if (!flush_dirty(upload_lines)) return;
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
 }
 #endif
+#else
+static inline void update_screen() {
+  flush_dirty(NULL);
+}
+#endif
+
+#ifdef CONFIG_VGA_FB_DUMP
+void fb_dump_frame(const void *vmem);
+void fb_dump_finish();
+bool init_fb_dump(int w, int h);
+static bool fb_dump = false;
 #endif
 
 void vga_update_screen() {
   if (vgactl_port_base[1] == 1) {
+    IFDEF(CONFIG_VGA_FB_DUMP, if (fb_dump && screen_dirty) fb_dump_frame(vmem));
     update_screen();
     vgactl_port_base[1] = 0;
   }
@@ -80,6 +129,13 @@ void vga_update_screen() {
   // then zero out the sync register
 }
 
+#ifdef CONFIG_VGA_FB_DUMP
+static void vga_exit() {
+  vga_update_screen();
+  fb_dump_finish();
+}
+#endif
+
 void init_vga() {
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
@@ -90,7 +146,18 @@ void init_vga() {
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
+  pitch = screen_width() * sizeof(uint32_t);
+  dirty_line = malloc(screen_height() * sizeof(bool));
+  assert(dirty_line);
+  // the whole screen is uploaded at the first sync
+  memset(dirty_line, true, screen_height() * sizeof(bool));
+  screen_dirty = true;
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+#ifdef CONFIG_VGA_FB_DUMP
+  fb_dump = init_fb_dump(screen_width(), screen_height());
+  // a sync just before exiting is not lost
+  if (fb_dump) atexit(vga_exit);
+#endif
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
 }
@@ -21,7 +21,7 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc, vaddr_t npc) {
   bool flag = true;
   for (int i = 0; i < MUXDEF(CONFIG_RVE, 16, 32); i++) {
     if (ref_r->gpr[i] != cpu.gpr[i]) {
-      printf("reg %s value mismatch: ref = %#x, dut = %#x, pc = %#x\n", reg_name(i), ref_r->gpr[i], cpu.gpr[i], pc);
+      printf("reg %s value mismatch: ref = " FMT_WORD ", dut = " FMT_WORD ", pc = " FMT_WORD "\n", reg_name(i), ref_r->gpr[i], cpu.gpr[i], pc);
       flag = false;
     }
   }
@@ -32,24 +32,24 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc, vaddr_t npc) {
 
   if (enable_csr_difftest) {
     if (ref_r->mstatus.val != cpu.mstatus.val) {
-      printf("mstatus value mismatch: ref = %#x, dut = %#x, pc = %#x\n", ref_r->mstatus.val, cpu.mstatus.val, pc);
+      printf("mstatus value mismatch: ref = " FMT_WORD ", dut = " FMT_WORD ", pc = " FMT_WORD "\n", ref_r->mstatus.val, cpu.mstatus.val, pc);
       //flag = false;
     }
 
     if (ref_r->mepc != cpu.mepc) {
-      printf("mpec value mismatch: ref = %#x, dut = %#x, pc = %#x\n", ref_r->mepc, cpu.mepc, pc);
+      printf("mpec value mismatch: ref = " FMT_WORD ", dut = " FMT_WORD ", pc = " FMT_WORD "\n", ref_r->mepc, cpu.mepc, pc);
     }
 
 
   }
 
   if (ref_r->pc != npc) {
-    printf("ref pc = %#x  dut pc = %#x\n", ref_r->pc, npc);
+    printf("ref pc = " FMT_WORD "  dut pc = " FMT_WORD "\n", ref_r->pc, npc);
     printf("csr registers:\n");
     //printf("mstatus = %#x\n", cpu.mstatus.val);
-    printf("mtvec = %#x\n", cpu.mtvec);
-    printf("mepc = %#x\n", cpu.mepc);
-    printf("mcause = %#x\n", cpu.mcause);
+    printf("mtvec = " FMT_WORD "\n", cpu.mtvec);
+    printf("mepc = " FMT_WORD "\n", cpu.mepc);
+    printf("mcause = " FMT_WORD "\n", cpu.mcause);
     flag = false;
   }
   
@@ -30,6 +30,10 @@ typedef union {
   word_t val;
 } MSTATUS;
 
+// interrupt bits of mip and mie
+#define MIP_MSIP (1 << 3)
+#define MIP_MTIP (1 << 7)
+#define MIP_MEIP (1 << 11)
 
 
 typedef struct {
@@ -39,7 +43,12 @@ typedef struct {
   word_t mtvec;      // Machine Trap-Vector Base Address Register
   word_t mepc;       // Machine Exception Program Counter
   word_t mcause;     // Machine Cause Register
+  word_t mscratch;   // Machine Scratch Register
+  word_t satp;       // Supervisor Address Translation and Protection Register
   uint32_t mode;   
+  // not exchanged with the REF of difftest
+  word_t mie;        // Machine Interrupt Enable Register
+  word_t mip;        // Machine Interrupt Pending Register, set by CLINT and PLIC
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
@@ -17,6 +17,9 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/reverse.h>
+#include <memory/paddr.h>
+#include <memory/host.h>
 #include <stdint.h>
 #include <elf.h>
 
@@ -37,17 +40,74 @@ static uint64_t max = 0;
 void difftest_skip_ref();
 #endif
 
+#ifdef CONFIG_DEVICE_IDLE
+// Wait until some interrupt is pending in mip & mie, even if it is disabled
+// by mstatus. An enabled one is then taken at the end of the block. When no
+// interrupt is enabled in mie, nothing can wake the hart up, so wfi does
+// not wait at all.
+static void wfi() {
+  bool device_idle();
+  if (reverse_replaying() || cpu.mie == 0) return;
+  while ((cpu.mip & cpu.mie) == 0 && nemu_state.state == NEMU_RUNNING && device_idle()) ;
+}
+#endif
+
+// The pending bits are set by the devices, so mip is read like a device
+// register: REF can not produce the value, and it is replayed from the log
+// by reverse execution, since the devices are not restored.
+static word_t mip_read() {
+  IFDEF(CONFIG_DIFFTEST, difftest_skip_ref());
+#ifdef CONFIG_REVERSE_EXEC
+  if (reverse_replaying()) return reverse_replay_input();
+#endif
+  reverse_record_input(cpu.mip);
+  return cpu.mip;
+}
+
 #define R(i) gpr(i)
+#ifdef CONFIG_RV_FAST_REG
+// Writes to $zero go to a sink, so $zero stays 0 without being reset
+// after every instruction. The indices used by an instruction are checked
+// once by decode_operand(), and the registers are then accessed directly.
+// Since the number of registers is a power of 2, the indices OR-ed
+// together are valid iff each of them is.
+static word_t zero_sink = 0;
+#define reg_ptr(i) ((i) == 0 ? &zero_sink : &cpu.gpr[i])
+#define checkR(idx) check_reg_idx(idx)
+#define GPR(i) (cpu.gpr[i])
+#else
+#define reg_ptr(i) (&R(i))
+#define checkR(idx)
+#define GPR(i) R(i)
+#endif
+#define Rd (*rdp)
+// bits 11:7 are part of the immediate or ignored in the other types
+#define HAS_RD(type) ((type) != TYPE_S && (type) != TYPE_B && (type) != TYPE_N)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
+#define XLEN (sizeof(word_t) * 8)
+#define SHAMT(x) ((x) & (XLEN - 1))
+// shamt[5] of slli/srli/srai is only valid on RV64
+#define SHAMT_PAT(f6) f6 MUXDEF(CONFIG_RV64, "? ?????", "0 ?????")
+// double-width types for the upper half of products, 128-bit on RV64
+typedef MUXDEF(CONFIG_RV64, unsigned __int128, uint64_t) dword_t;
+typedef MUXDEF(CONFIG_RV64, __int128, int64_t) sdword_t;
+
+// Division never traps. Dividing by zero and the signed overflow
+// (-2^(XLEN-1) / -1) give the results defined by the spec.
+#define DIVS(S, U, a, b) ((S)(b) == 0 ? (U)-1 : (S)(b) == -1 ? -(U)(a) : (U)((S)(a) / (S)(b)))
+#define REMS(S, U, a, b) ((S)(b) == 0 ? (U)(a) : (S)(b) == -1 ? 0 : (U)((S)(a) % (S)(b)))
+#define DIVU(U, a, b) ((U)(b) == 0 ? (U)-1 : (U)(a) / (U)(b))
+#define REMU(U, a, b) ((U)(b) == 0 ? (U)(a) : (U)(a) % (U)(b))
+
 enum {
   TYPE_I, TYPE_U, TYPE_S, TYPE_J, TYPE_B, TYPE_R,
   TYPE_N, TYPE_Z,// none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
+#define src1R() do { *src1 = GPR(rs1); } while (0)
+#define src2R() do { *src2 = GPR(rs2); } while (0)
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
@@ -60,18 +120,74 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   int rs2 = BITS(i, 24, 20);
   *rd     = BITS(i, 11, 7);
   switch (type) {
-    case TYPE_I: src1R();          immI(); break;
-    case TYPE_U:                   immU(); break;
-    case TYPE_S: src1R(); src2R(); immS(); break;
-    case TYPE_J:                   immJ(); break;
-    case TYPE_B: src1R(); src2R(); immB(); break;
-    case TYPE_R: src1R(); src2R();         break;
-    case TYPE_Z: src1R();          immZ(); break;
+    case TYPE_I: checkR(*rd | rs1);       src1R();          immI(); break;
+    case TYPE_U: checkR(*rd);                               immU(); break;
+    case TYPE_S: checkR(rs1 | rs2);       src1R(); src2R(); immS(); break;
+    case TYPE_J: checkR(*rd);                               immJ(); break;
+    case TYPE_B: checkR(rs1 | rs2);       src1R(); src2R(); immB(); break;
+    case TYPE_R: checkR(*rd | rs1 | rs2); src1R(); src2R();         break;
+    case TYPE_Z: checkR(*rd | rs1);       src1R();          immZ(); break;
     case TYPE_N: break;
     default: panic("unsupported type = %d", type);
   }
 }
 
+#ifdef CONFIG_INST_FUSION
+#define FUSE(name, ...) do { \
+  INSTPAT_STAT_START(); \
+  __VA_ARGS__ ; \
+  INSTPAT_STAT_END(name); \
+} while (0)
+
+#define in_pmem2(addr) (in_pmem(addr) && in_pmem((addr) + 3))
+
+// Called after lui, auipc, slt(i)(u) and `addi sp, sp, imm' write `rd'.
+// If the next instruction is an addi, load, store, jalr or branch based on
+// `rd', it is executed here without going through decode_exec(). This
+// covers idioms like lui+addi, auipc+jalr, auipc+lw, slt+bnez and the
+// stack adjustment in function prologues. A load or store to a device is
+// left to decode_exec(), since the device must observe it after the first
+// instruction is counted in g_nr_guest_inst.
+static void fuse_next(Decode *s, int rd) {
+  vaddr_t pc = s->snpc;
+  if (!s->fuse || rd == 0 || !in_pmem2(pc)) return;
+  uint32_t i = host_read(guest_to_host(pc), 4);
+  if (BITS(i, 19, 15) != rd) return;
+
+  // rd and rs2 are only valid registers for some of the instructions below
+  int rd2 = BITS(i, 11, 7), rs2 = BITS(i, 24, 20);
+  word_t src1 = GPR(rd); // checked by the first instruction
+  word_t immI = SEXT(BITS(i, 31, 20), 12);
+  word_t immS = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7);
+  word_t immB = (SEXT(BITS(i, 31, 31), 1) << 11 | BITS(i, 7, 7) << 10 |
+      BITS(i, 30, 25) << 4 | BITS(i, 11, 8)) << 1;
+  vaddr_t snpc = pc + 4;
+  vaddr_t dnpc = snpc;
+  cpu.pc = pc; // the second instruction may fail
+  switch (BITS(i, 14, 12) << 7 | BITS(i, 6, 0)) {
+    case 0 << 7 | 0x13: FUSE(fused_addi, *reg_ptr(check_reg_idx(rd2)) = src1 + immI); break;
+    case 2 << 7 | 0x03: if (!in_pmem2(src1 + immI)) goto no_fuse;
+                        FUSE(fused_lw  , *reg_ptr(check_reg_idx(rd2)) = (int32_t)Mr(src1 + immI, 4)); break;
+    case 2 << 7 | 0x23: if (!in_pmem2(src1 + immS)) goto no_fuse;
+                        FUSE(fused_sw  , Mw(src1 + immS, 4, R(rs2))); break;
+    case 0 << 7 | 0x67: FUSE(fused_jalr, *reg_ptr(check_reg_idx(rd2)) = snpc; dnpc = src1 + immI); break;
+    case 0 << 7 | 0x63: FUSE(fused_beq , if (src1 == R(rs2)) dnpc = pc + immB); break;
+    case 1 << 7 | 0x63: FUSE(fused_bne , if (src1 != R(rs2)) dnpc = pc + immB); break;
+    default: goto no_fuse;
+  }
+  s->snpc = snpc;
+  s->dnpc = dnpc;
+  s->nr_inst = 2;
+  return;
+
+no_fuse:
+  cpu.pc = s->pc;
+}
+#define FUSE_NEXT(rd) fuse_next(s, rd)
+#else
+#define FUSE_NEXT(rd)
+#endif
+
 static int decode_exec(Decode *s) {
   s->dnpc = s->snpc;
 
@@ -80,18 +196,19 @@ static int decode_exec(Decode *s) {
   int rd = 0; \
   word_t src1 = 0, src2 = 0, imm = 0; \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  __attribute__((unused)) word_t *rdp = HAS_RD(concat(TYPE_, type)) ? reg_ptr(rd) : NULL; \
   __VA_ARGS__ ; \
 }
 
   INSTPAT_START();
   // U type
-  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
-  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui  , U, R(rd) = imm);
+  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, Rd = s->pc + imm; FUSE_NEXT(rd));
+  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui  , U, Rd = imm; FUSE_NEXT(rd));
 
-  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, Rd = Mr(src1 + imm, 1));
 
   // J type
-  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, {R(rd) = s->snpc; s->dnpc = s->pc + imm;
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, {Rd = s->snpc; s->dnpc = s->pc + imm;
 #ifdef CONFIG_FTRACE
     if (p == NULL) {
       init = p = (char *)malloc(1000);
@@ -125,7 +242,7 @@ static int decode_exec(Decode *s) {
   }
 #endif
   });
-  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, {R(rd) = s->snpc; s->dnpc = src1 + imm;
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, {Rd = s->snpc; s->dnpc = src1 + imm;
 #ifdef CONFIG_FTRACE
     if (p == NULL) {
       init = p = (char *)malloc(1000);
@@ -188,7 +305,9 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
   INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, src2));
   INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
+#ifdef CONFIG_RV64
   INSTPAT("??????? ????? ????? 011 ????? 01000 11", sd     , S, Mw(src1 + imm, 8, src2));
+#endif
 
 
   // B type
@@ -200,46 +319,67 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu    , B, s->dnpc = (src1 < src2 ? s->pc + imm : s->snpc));
 
   // I type
-  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi    , I, R(rd) = src1 + imm);
-  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb      , I, R(rd) = (int8_t)Mr(src1 + imm, 1));
-  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu     , I, R(rd) = Mr(src1 + imm, 1));
-  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh      , I, R(rd) = (int16_t)Mr(src1 + imm, 2));
-  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu     , I, R(rd) = Mr(src1 + imm, 2));
-  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw      , I, R(rd) = (int32_t)Mr(src1 + imm, 4));
-  INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld      , I, R(rd) = (int64_t)Mr(src1 + imm, 8));
-  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti    , I, R(rd) = ((sword_t)src1 < (sword_t)imm) ? 1 : 0);
-  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu   , I, R(rd) = (src1 < imm) ? 1 : 0);
-  INSTPAT("0000000 ????? ????? 001 ????? 00100 11", slli    , I, R(rd) = src1 << (0x0000001f & imm));
-  INSTPAT("0000000 ????? ????? 101 ????? 00100 11", srli    , I, R(rd) = src1 >> (0x0000001f & imm));
-  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi    , I, R(rd) = src1 & imm);
-  INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai    , I, R(rd) = (sword_t)src1 >> (0x0000001f & imm););
-  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori    , I, R(rd) = src1 ^ imm);
-  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori     , I, R(rd) = src1 | imm);
+  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi    , I, Rd = src1 + imm; if (rd == 2 && BITS(s->isa.inst, 19, 15) == 2) FUSE_NEXT(rd));
+  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb      , I, Rd = (int8_t)Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu     , I, Rd = Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh      , I, Rd = (int16_t)Mr(src1 + imm, 2));
+  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu     , I, Rd = Mr(src1 + imm, 2));
+  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw      , I, Rd = (int32_t)Mr(src1 + imm, 4));
+  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti    , I, Rd = ((sword_t)src1 < (sword_t)imm) ? 1 : 0; FUSE_NEXT(rd));
+  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu   , I, Rd = (src1 < imm) ? 1 : 0; FUSE_NEXT(rd));
+  INSTPAT(SHAMT_PAT("000000") " ????? 001 ????? 00100 11", slli    , I, Rd = src1 << SHAMT(imm));
+  INSTPAT(SHAMT_PAT("000000") " ????? 101 ????? 00100 11", srli    , I, Rd = src1 >> SHAMT(imm));
+  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi    , I, Rd = src1 & imm);
+  INSTPAT(SHAMT_PAT("010000") " ????? 101 ????? 00100 11", srai    , I, Rd = (sword_t)src1 >> SHAMT(imm));
+  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori    , I, Rd = src1 ^ imm);
+  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori     , I, Rd = src1 | imm);
+
+#ifdef CONFIG_RV64
+  INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld      , I, Rd = Mr(src1 + imm, 8));
+  INSTPAT("??????? ????? ????? 110 ????? 00000 11", lwu     , I, Rd = Mr(src1 + imm, 4));
+  INSTPAT("??????? ????? ????? 000 ????? 00110 11", addiw   , I, Rd = (int32_t)(src1 + imm));
+  INSTPAT("0000000 ????? ????? 001 ????? 00110 11", slliw   , I, Rd = (int32_t)((uint32_t)src1 << BITS(imm, 4, 0)));
+  INSTPAT("0000000 ????? ????? 101 ????? 00110 11", srliw   , I, Rd = (int32_t)((uint32_t)src1 >> BITS(imm, 4, 0)));
+  INSTPAT("0100000 ????? ????? 101 ????? 00110 11", sraiw   , I, Rd = (int32_t)src1 >> BITS(imm, 4, 0));
+#endif
 
 
 
   // R type
-  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add      , R, R(rd) = (sword_t)src1 + (sword_t)src2);
-  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub      , R, R(rd) = (sword_t)src1 - (sword_t)src2);
-  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra      , R, R(rd) = (sword_t)src1 >> (0x0000001f & src2));
-  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll      , R, R(rd) = src1 << (0x0000001f & src2));
-  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl      , R, R(rd) = src1 >> (0x0000001f & src2));
-  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra      , R, R(rd) = (sword_t)src1 >> (0x0000001f & src2));
-  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt      , R, R(rd) = ((sword_t)src1 < (sword_t)src2) ? 1 : 0);
-  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu     , R, R(rd) = (src1 < src2) ? 1 : 0);
-
-  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul      , R, R(rd) = (int64_t)src1 * (int64_t)src2);
-  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh     , R, R(rd) = (int64_t)(sword_t)src1 * (int64_t)(sword_t)src2 >> 32);
-  INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu    , R, R(rd) = (uint64_t)src1 * (uint64_t)src2 >> 32);
-
-  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div      , R, R(rd) = (sword_t)src1 / (sword_t)src2);
-  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu     , R, R(rd) = src1 / src2);
-  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem      , R, R(rd) = (sword_t)src1 % (sword_t)src2);
-  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu     , R, R(rd) = src1 % src2);
-
-  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and      , R, R(rd) = src1 & src2);
-  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or       , R, R(rd) = src1 | src2);
-  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor      , R, R(rd) = src1 ^ src2);
+  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add      , R, Rd = (sword_t)src1 + (sword_t)src2);
+  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub      , R, Rd = (sword_t)src1 - (sword_t)src2);
+  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra      , R, Rd = (sword_t)src1 >> SHAMT(src2));
+  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll      , R, Rd = src1 << SHAMT(src2));
+  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl      , R, Rd = src1 >> SHAMT(src2));
+  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt      , R, Rd = ((sword_t)src1 < (sword_t)src2) ? 1 : 0; FUSE_NEXT(rd));
+  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu     , R, Rd = (src1 < src2) ? 1 : 0; FUSE_NEXT(rd));
+
+  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul      , R, Rd = src1 * src2);
+  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh     , R, Rd = (sdword_t)(sword_t)src1 * (sword_t)src2 >> XLEN);
+  INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu   , R, Rd = (sdword_t)(sword_t)src1 * (sdword_t)src2 >> XLEN);
+  INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu    , R, Rd = (dword_t)src1 * src2 >> XLEN);
+
+  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div      , R, Rd = DIVS(sword_t, word_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu     , R, Rd = DIVU(word_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem      , R, Rd = REMS(sword_t, word_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu     , R, Rd = REMU(word_t, src1, src2));
+
+  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and      , R, Rd = src1 & src2);
+  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or       , R, Rd = src1 | src2);
+  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor      , R, Rd = src1 ^ src2);
+
+#ifdef CONFIG_RV64
+  INSTPAT("0000000 ????? ????? 000 ????? 01110 11", addw     , R, Rd = (int32_t)(src1 + src2));
+  INSTPAT("0100000 ????? ????? 000 ????? 01110 11", subw     , R, Rd = (int32_t)(src1 - src2));
+  INSTPAT("0000000 ????? ????? 001 ????? 01110 11", sllw     , R, Rd = (int32_t)((uint32_t)src1 << BITS(src2, 4, 0)));
+  INSTPAT("0000000 ????? ????? 101 ????? 01110 11", srlw     , R, Rd = (int32_t)((uint32_t)src1 >> BITS(src2, 4, 0)));
+  INSTPAT("0100000 ????? ????? 101 ????? 01110 11", sraw     , R, Rd = (int32_t)src1 >> BITS(src2, 4, 0));
+  INSTPAT("0000001 ????? ????? 000 ????? 01110 11", mulw     , R, Rd = (int32_t)(src1 * src2));
+  INSTPAT("0000001 ????? ????? 100 ????? 01110 11", divw     , R, Rd = (int32_t)DIVS(int32_t, uint32_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 101 ????? 01110 11", divuw    , R, Rd = (int32_t)DIVU(uint32_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 110 ????? 01110 11", remw     , R, Rd = (int32_t)REMS(int32_t, uint32_t, src1, src2));
+  INSTPAT("0000001 ????? ????? 111 ????? 01110 11", remuw    , R, Rd = (int32_t)REMU(uint32_t, src1, src2));
+#endif
 
 
   // csr register
@@ -248,30 +388,54 @@ static int decode_exec(Decode *s) {
       case 0x300: {
         word_t t = cpu.mstatus.val;
         cpu.mstatus.val = src1;
-        R(rd) = t;
+        Rd = t;
+        g_intr_pending = true;
         break;
       }
       case 0x305: {
         word_t t = cpu.mtvec;
         cpu.mtvec = src1;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }     // mtvec
       case 0x341: {
         word_t t = cpu.mepc;
         cpu.mepc = src1;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }      // mepc
       case 0x342: {
         word_t t = cpu.mcause;
         cpu.mcause = src1;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }    // mcause
+      case 0x340: {
+        word_t t = cpu.mscratch;
+        cpu.mscratch = src1;
+        Rd = t;
+        break;
+      }    // mscratch
+      case 0x180: {
+        word_t t = cpu.satp;
+        cpu.satp = src1;
+        Rd = t;
+        break;
+      }    // satp
+      case 0x304: {
+        word_t t = cpu.mie;
+        cpu.mie = src1;
+        Rd = t;
+        g_intr_pending = true;
+        break;
+      }    // mie
+      case 0x344: {
+        Rd = mip_read();
+        break;
+      }    // mip
       default: panic();                // 
     }
   });
@@ -282,36 +446,61 @@ static int decode_exec(Decode *s) {
       case 0x300: {
         word_t t = cpu.mstatus.val;
         cpu.mstatus.val = src1 | t;
-        R(rd) = t;
+        Rd = t;
+        g_intr_pending = true;
         break;
       }
       case 0x305: {
         word_t t = cpu.mtvec;
         cpu.mtvec = src1 | t;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }     // mtvec
       case 0x341: {
         word_t t = cpu.mepc;
         cpu.mepc = src1 | t;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }      // mepc
       case 0x342: {
         word_t t = cpu.mcause;
         cpu.mcause = src1 | t;
-        R(rd) = t;
+        Rd = t;
         break;
 
       }    // mcause
+      case 0x340: {
+        word_t t = cpu.mscratch;
+        cpu.mscratch = src1 | t;
+        Rd = t;
+        break;
+      }    // mscratch
+      case 0x180: {
+        word_t t = cpu.satp;
+        cpu.satp = src1 | t;
+        Rd = t;
+        break;
+      }    // satp
+      case 0x304: {
+        word_t t = cpu.mie;
+        cpu.mie = src1 | t;
+        Rd = t;
+        g_intr_pending = true;
+        break;
+      }    // mie
+      case 0x344: {
+        Rd = mip_read();
+        break;
+      }    // mip
       default: Assert(0, "should not reach here");                // 
     }
   });
 
   INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(11, s->pc); );
   INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = isa_mret_intr(); );
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, IFDEF(CONFIG_DEVICE_IDLE, wfi()));
 
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10)); IFDEF(CONFIG_DIFFTEST, difftest_skip_ref();)); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
@@ -319,12 +508,39 @@ static int decode_exec(Decode *s) {
 
 
   INSTPAT_END();
-  R(0) = 0; // reset $zero to 0
+  IFNDEF(CONFIG_RV_FAST_REG, R(0) = 0); // reset $zero to 0
 
   return 0;
 }
 
+#ifdef CONFIG_RVC
+uint32_t rvc_decode(uint32_t c);
+
+static inline uint32_t rvc_fetch(Decode *s) {
+  if ((s->pc & PAGE_MASK) > PAGE_SIZE - 4) {
+    // the instruction may cross a page boundary, so fetch it in two halves
+    uint32_t lo = inst_fetch(&s->snpc, 2);
+    return (lo & 0x3) != 0x3 ? lo : lo | (inst_fetch(&s->snpc, 2) << 16);
+  }
+  uint32_t inst = inst_fetch(&s->snpc, 4);
+  if ((inst & 0x3) == 0x3) return inst;
+  s->snpc -= 2;
+  return inst & 0xffff;
+}
+#endif
+
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_RVC
+  uint32_t inst = rvc_fetch(s);
+  if ((inst & 0x3) != 0x3) {
+    s->isa.inst = rvc_decode(inst);
+    int ret = decode_exec(s);
+    s->isa.inst = inst; // keep the compressed encoding for the tracers
+    return ret;
+  }
+  s->isa.inst = inst;
+#else
   s->isa.inst = inst_fetch(&s->snpc, 4);
+#endif
   return decode_exec(s);
 }
@@ -24,14 +24,14 @@ const char *regs[] = {
 };
 
 void isa_reg_display() {
-  for (int i = 0; i < 32; i++) {
-    printf("%-10s  0x%016x  %-18u\n", regs[i], cpu.gpr[i], cpu.gpr[i]);
+  for (int i = 0; i < ARRLEN(cpu.gpr); i++) {
+    printf("%-10s  0x%016" PRIx64 "  %-18" PRIu64 "\n", regs[i], (uint64_t)cpu.gpr[i], (uint64_t)cpu.gpr[i]);
   }  
   return;
 }
 
 word_t isa_reg_str2val(const char *s, bool *success) {
-  for (int i = 0; i < 32; i++) {
+  for (int i = 0; i < ARRLEN(cpu.gpr); i++) {
     if (strcmp(regs[i], s + 1) == 0) {
       *success = true;
       return cpu.gpr[i];
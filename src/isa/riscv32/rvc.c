@@ -0,0 +1,169 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_RVC
+
+// A compressed instruction is expanded to its 32-bit form, which is then
+// executed by decode_exec() as usual. Expansions are cached for all the
+// 65536 encodings, so each one is only expanded once.
+
+#define R_(f7, rs2, rs1, f3, rd, op) \
+  (((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define I_(imm, rs1, f3, rd, op) \
+  ((((imm) & 0xfff) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define S_(imm, rs2, rs1, f3, op) \
+  ((BITS(imm, 11, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | (BITS(imm, 4, 0) << 7) | (op))
+#define B_(imm, rs2, rs1, f3) \
+  ((BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | \
+   ((f3) << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | 0x63)
+#define J_(imm, rd) \
+  ((BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) | \
+   (BITS(imm, 19, 12) << 12) | ((rd) << 7) | 0x6f)
+
+#define OP_IMM  0x13
+#define OP_IMM32 0x1b
+#define OP      0x33
+#define OP_32   0x3b
+#define LOAD    0x03
+#define STORE   0x23
+#define JALR    0x67
+
+// 0 is returned for illegal instructions, which are then reported by decode_exec()
+static uint32_t rvc_expand(uint32_t c) {
+  uint32_t rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+  uint32_t rd_ = BITS(c, 4, 2) + 8, rs1_ = BITS(c, 9, 7) + 8;
+  uint32_t imm6 = SEXT(BITS(c, 12, 12) << 5 | BITS(c, 6, 2), 6);
+  uint32_t joff = SEXT(BITS(c, 12, 12) << 11 | BITS(c, 8, 8) << 10 | BITS(c, 10, 9) << 8 |
+      BITS(c, 6, 6) << 7 | BITS(c, 7, 7) << 6 | BITS(c, 2, 2) << 5 | BITS(c, 11, 11) << 4 |
+      BITS(c, 5, 3) << 1, 12);
+  uint32_t boff = SEXT(BITS(c, 12, 12) << 8 | BITS(c, 6, 5) << 6 | BITS(c, 2, 2) << 5 |
+      BITS(c, 11, 10) << 3 | BITS(c, 4, 3) << 1, 9);
+  uint32_t shamt = BITS(c, 12, 12) << 5 | BITS(c, 6, 2);
+  uint32_t imm;
+
+  switch (BITS(c, 1, 0) << 3 | BITS(c, 15, 13)) {
+    // quadrant 0
+    case 0 << 3 | 0: // c.addi4spn
+      imm = BITS(c, 10, 7) << 6 | BITS(c, 12, 11) << 4 | BITS(c, 5, 5) << 3 | BITS(c, 6, 6) << 2;
+      return imm == 0 ? 0 : I_(imm, 2, 0, rd_, OP_IMM);
+    case 0 << 3 | 2: // c.lw
+      imm = BITS(c, 5, 5) << 6 | BITS(c, 12, 10) << 3 | BITS(c, 6, 6) << 2;
+      return I_(imm, rs1_, 2, rd_, LOAD);
+    case 0 << 3 | 6: // c.sw
+      imm = BITS(c, 5, 5) << 6 | BITS(c, 12, 10) << 3 | BITS(c, 6, 6) << 2;
+      return S_(imm, rd_, rs1_, 2, STORE);
+#ifdef CONFIG_RV64
+    case 0 << 3 | 3: // c.ld
+      imm = BITS(c, 6, 5) << 6 | BITS(c, 12, 10) << 3;
+      return I_(imm, rs1_, 3, rd_, LOAD);
+    case 0 << 3 | 7: // c.sd
+      imm = BITS(c, 6, 5) << 6 | BITS(c, 12, 10) << 3;
+      return S_(imm, rd_, rs1_, 3, STORE);
+#endif
+
+    // quadrant 1
+    case 1 << 3 | 0: // c.addi, c.nop
+      return I_(imm6, rd, 0, rd, OP_IMM);
+#ifdef CONFIG_RV64
+    case 1 << 3 | 1: // c.addiw
+      return rd == 0 ? 0 : I_(imm6, rd, 0, rd, OP_IMM32);
+#else
+    case 1 << 3 | 1: // c.jal
+      return J_(joff, 1);
+#endif
+    case 1 << 3 | 2: // c.li
+      return I_(imm6, 0, 0, rd, OP_IMM);
+    case 1 << 3 | 3:
+      if (rd == 2) { // c.addi16sp
+        imm = SEXT(BITS(c, 12, 12) << 9 | BITS(c, 4, 3) << 7 | BITS(c, 5, 5) << 6 |
+            BITS(c, 2, 2) << 5 | BITS(c, 6, 6) << 4, 10);
+        return imm == 0 ? 0 : I_(imm, 2, 0, 2, OP_IMM);
+      }
+      // c.lui
+      return imm6 == 0 ? 0 : ((imm6 & 0xfffff) << 12) | (rd << 7) | 0x37;
+    case 1 << 3 | 4:
+      switch (BITS(c, 11, 10)) {
+        case 0: // c.srli
+          if (MUXDEF(CONFIG_RV64, false, shamt >= 32)) return 0;
+          return I_(shamt, rs1_, 5, rs1_, OP_IMM);
+        case 1: // c.srai
+          if (MUXDEF(CONFIG_RV64, false, shamt >= 32)) return 0;
+          return I_(0x400 | shamt, rs1_, 5, rs1_, OP_IMM);
+        case 2: // c.andi
+          return I_(imm6, rs1_, 7, rs1_, OP_IMM);
+        default:
+          switch (BITS(c, 12, 12) << 2 | BITS(c, 6, 5)) {
+            case 0: return R_(0x20, rd_, rs1_, 0, rs1_, OP); // c.sub
+            case 1: return R_(0x00, rd_, rs1_, 4, rs1_, OP); // c.xor
+            case 2: return R_(0x00, rd_, rs1_, 6, rs1_, OP); // c.or
+            case 3: return R_(0x00, rd_, rs1_, 7, rs1_, OP); // c.and
+#ifdef CONFIG_RV64
+            case 4: return R_(0x20, rd_, rs1_, 0, rs1_, OP_32); // c.subw
+            case 5: return R_(0x00, rd_, rs1_, 0, rs1_, OP_32); // c.addw
+#endif
+            default: return 0;
+          }
+      }
+    case 1 << 3 | 5: // c.j
+      return J_(joff, 0);
+    case 1 << 3 | 6: // c.beqz
+      return B_(boff, 0, rs1_, 0);
+    case 1 << 3 | 7: // c.bnez
+      return B_(boff, 0, rs1_, 1);
+
+    // quadrant 2
+    case 2 << 3 | 0: // c.slli
+      if (MUXDEF(CONFIG_RV64, false, shamt >= 32)) return 0;
+      return I_(shamt, rd, 1, rd, OP_IMM);
+    case 2 << 3 | 2: // c.lwsp
+      imm = BITS(c, 3, 2) << 6 | BITS(c, 12, 12) << 5 | BITS(c, 6, 4) << 2;
+      return rd == 0 ? 0 : I_(imm, 2, 2, rd, LOAD);
+    case 2 << 3 | 6: // c.swsp
+      imm = BITS(c, 8, 7) << 6 | BITS(c, 12, 9) << 2;
+      return S_(imm, rs2, 2, 2, STORE);
+#ifdef CONFIG_RV64
+    case 2 << 3 | 3: // c.ldsp
+      imm = BITS(c, 4, 2) << 6 | BITS(c, 12, 12) << 5 | BITS(c, 6, 5) << 3;
+      return rd == 0 ? 0 : I_(imm, 2, 3, rd, LOAD);
+    case 2 << 3 | 7: // c.sdsp
+      imm = BITS(c, 9, 7) << 6 | BITS(c, 12, 10) << 3;
+      return S_(imm, rs2, 2, 3, STORE);
+#endif
+    case 2 << 3 | 4:
+      if (BITS(c, 12, 12) == 0) {
+        if (rs2 == 0) return rd == 0 ? 0 : I_(0, rd, 0, 0, JALR); // c.jr
+        return R_(0, rs2, 0, 0, rd, OP);                          // c.mv
+      }
+      if (rs2 == 0) {
+        if (rd == 0) return 0x00100073;                           // c.ebreak
+        return I_(0, rd, 0, 1, JALR);                             // c.jalr
+      }
+      return R_(0, rs2, rd, 0, rd, OP);                           // c.add
+
+    default: return 0;
+  }
+}
+
+static uint32_t rvc_cache[1 << 16] = {};
+
+uint32_t rvc_decode(uint32_t c) {
+  uint32_t inst = rvc_cache[c];
+  if (unlikely(inst == 0)) inst = rvc_cache[c] = rvc_expand(c);
+  return inst;
+}
+
+#endif
@@ -15,12 +15,18 @@
 
 
 #include <isa.h>
+#include <cpu/cpu.h>
 
 #define CAUSE_USER_ECALL 8
 #define CAUSE_SUPERVISOR_ECALL 9
 #define CAUSE_MACHINE_ECALL 11
 #define CAUSE_LOAD_PAGE_FAULT 13
 
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+#define IRQ_MSI 3
+#define IRQ_MTI 7
+#define IRQ_MEI 11
+
 #define PRV_U 0
 #define PRV_S 1
 #define PRV_M 3
@@ -49,6 +55,7 @@ word_t isa_raise_intr(word_t NO, vaddr_t epc) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * Then return the address of the interrupt/exception vector.
    */
+  IFDEF(CONFIG_STATS, g_nr_trap ++);
   cpu.mepc = epc;
   cpu.mcause = NO;
   cpu.mstatus.fields.MPIE = cpu.mstatus.fields.MIE;
@@ -58,17 +65,26 @@ word_t isa_raise_intr(word_t NO, vaddr_t epc) {
 #ifdef CONFIG_ETRACE
   log_exception();
 #endif
-  return cpu.mtvec;
+  // vectored mode
+  if ((cpu.mtvec & 1) && (NO & INTR_BIT)) return (cpu.mtvec & ~(word_t)3) + 4 * (NO & ~INTR_BIT);
+  return cpu.mtvec & ~(word_t)3;
 }
 
 word_t isa_mret_intr() {
   cpu.mstatus.fields.MIE = cpu.mstatus.fields.MPIE;
   cpu.mstatus.fields.MPIE = 1;
   cpu.mstatus.fields.MPP = 0;
+  g_intr_pending = true;
   return cpu.mepc;
 }
 
 word_t isa_query_intr() {
+  word_t pending = cpu.mip & cpu.mie;
+  if (pending == 0 || (cpu.mode == PRV_M && !cpu.mstatus.fields.MIE)) return INTR_EMPTY;
+  // in the priority order of the spec
+  if (pending & MIP_MEIP) return INTR_BIT | IRQ_MEI;
+  if (pending & MIP_MSIP) return INTR_BIT | IRQ_MSI;
+  if (pending & MIP_MTIP) return INTR_BIT | IRQ_MTI;
   return INTR_EMPTY;
 }
 
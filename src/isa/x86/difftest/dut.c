@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <memory/vaddr.h>
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
@@ -23,3 +24,17 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
 
 void isa_difftest_attach() {
 }
+
+#ifdef CONFIG_DIFFTEST_FAST_FORWARD
+// KVM fixes up the stack and eflags after these instructions while
+// single-stepping (see patching() in tools/kvm-diff), so REF must not run
+// them natively. Return true if the instruction at `pc' is one of them.
+bool isa_difftest_ff_barrier(vaddr_t pc) {
+  switch (vaddr_ifetch(pc, 1)) {
+    case 0x9c: case 0x9d: case 0xcf: return true; // pushf, popf, iret
+    case 0x06: case 0x1e: return true;            // push %es, push %ds
+    case 0x0f: return vaddr_ifetch(pc + 1, 1) == 0xa0; // push %fs
+    default: return false;
+  }
+}
+#endif
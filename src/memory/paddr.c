@@ -15,8 +15,10 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/reverse.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -49,6 +51,50 @@ static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
 }
 
+#define NR_PMEM_PAGE (CONFIG_MSIZE >> PAGE_SHIFT)
+
+#ifdef CONFIG_WATCHPOINT
+void watchpoint_mem_write(paddr_t addr, int len);
+
+// one bit for each page of pmem, set if some watchpoint reads that page
+static uint64_t watched_page[NR_PMEM_PAGE / 64 + 1] = {};
+
+static inline bool page_watched(paddr_t addr) {
+  paddr_t pg = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  return (watched_page[pg / 64] >> (pg % 64)) & 1;
+}
+
+void paddr_watch(paddr_t addr, int len) {
+  assert(in_pmem(addr) && in_pmem(addr + len - 1));
+  paddr_t pg_lo = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  paddr_t pg_hi = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  for (paddr_t pg = pg_lo; pg <= pg_hi; pg ++) {
+    watched_page[pg / 64] |= 1ull << (pg % 64);
+  }
+}
+
+void paddr_watch_clear() {
+  memset(watched_page, 0, sizeof(watched_page));
+}
+#endif
+
+#ifdef CONFIG_REVERSE_EXEC
+// one bit for each page of pmem, set if the page is saved since the last
+// checkpoint of reverse execution
+static uint64_t saved_page[NR_PMEM_PAGE / 64 + 1] = {};
+
+static inline void save_page(paddr_t addr) {
+  paddr_t pg = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  if (likely((saved_page[pg / 64] >> (pg % 64)) & 1)) return;
+  saved_page[pg / 64] |= 1ull << (pg % 64);
+  reverse_save_page(addr & ~PAGE_MASK);
+}
+
+void paddr_saved_clear() {
+  memset(saved_page, 0, sizeof(saved_page));
+}
+#endif
+
 static void out_of_bound(paddr_t addr) {
 #ifdef CONFIG_RTRACE
   int in = (s.index + 19) % 20;
@@ -93,7 +139,33 @@ void paddr_write(paddr_t addr, int len, word_t data) {
 #ifdef CONFIG_MTRACE
   printf("WRITE   " FMT_WORD "   %d   " FMT_WORD "\n", addr, len, data);
 #endif
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  if (likely(in_pmem(addr))) {
+#ifdef CONFIG_WATCHPOINT
+    if (unlikely(page_watched(addr) || page_watched(addr + len - 1))) {
+      watchpoint_mem_write(addr, len);
+    }
+#endif
+#ifdef CONFIG_REVERSE_EXEC
+    save_page(addr);
+    save_page(addr + len - 1);
+#endif
+    pmem_write(addr, len, data);
+    return;
+  }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+uint8_t* paddr_dma(paddr_t addr, size_t len, bool is_write) {
+  if (len == 0 || !in_pmem(addr) || !in_pmem(addr + len - 1) || addr + len - 1 < addr) return NULL;
+  if (is_write) {
+    // the pages written by devices should be seen by watchpoints and reverse execution
+    for (paddr_t pg = addr & ~PAGE_MASK; pg < addr + len; pg += PAGE_SIZE) {
+#ifdef CONFIG_WATCHPOINT
+      if (unlikely(page_watched(pg))) watchpoint_mem_write(addr, len);
+#endif
+      IFDEF(CONFIG_REVERSE_EXEC, save_page(pg));
+    }
+  }
+  return guest_to_host(addr);
+}
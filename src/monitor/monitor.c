@@ -25,6 +25,8 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm();
+void init_record(const char *record_file, const char *replay_file);
+void init_stats(const char *stats_file);
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -41,11 +43,22 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_gdb_port(int port);
+void sdcard_set_overlay(const char *file);
+void vga_set_fb_dump(const char *path);
+void audio_set_wav(const char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static char *elf_file = NULL;
+#ifdef CONFIG_RECORD_REPLAY
+static char *record_file = NULL;
+static char *replay_file = NULL;
+#endif
+#ifdef CONFIG_STATS
+static char *stats_file = NULL;
+#endif
 static int difftest_port = 1234;
 #ifdef CONFIG_FTRACE
 Elf32_Ehdr elf_header;
@@ -170,16 +183,36 @@ static int parse_args(int argc, char *argv[]) {
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
     {"elf"     , required_argument, NULL, 'e'},
+    {"gdb"      , required_argument, NULL, 'g'},
+    {"record"   , required_argument, NULL, 'r'},
+    {"replay"   , required_argument, NULL, 'R'},
+    {"stats"    , required_argument, NULL, 's'},
+    {"sdcard-overlay", required_argument, NULL, 'o'},
+    {"fb-dump"  , required_argument, NULL, 'f'},
+    {"audio-wav", required_argument, NULL, 'w'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:g:r:R:s:o:f:w:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'e': elf_file = optarg; break;
+      case 'g': sdb_set_gdb_port(atoi(optarg)); break;
+      case 'r': MUXDEF(CONFIG_RECORD_REPLAY, record_file = optarg,
+                    panic("--record requires CONFIG_RECORD_REPLAY")); break;
+      case 'R': MUXDEF(CONFIG_RECORD_REPLAY, replay_file = optarg,
+                    panic("--replay requires CONFIG_RECORD_REPLAY")); break;
+      case 's': MUXDEF(CONFIG_STATS, stats_file = optarg,
+                    panic("--stats requires CONFIG_STATS")); break;
+      case 'o': MUXDEF(CONFIG_SDCARD_COW, sdcard_set_overlay(optarg),
+                    panic("--sdcard-overlay requires CONFIG_SDCARD_COW")); break;
+      case 'f': MUXDEF(CONFIG_VGA_FB_DUMP, vga_set_fb_dump(optarg),
+                    panic("--fb-dump requires CONFIG_VGA_FB_DUMP")); break;
+      case 'w': MUXDEF(CONFIG_HAS_AUDIO, audio_set_wav(optarg),
+                    panic("--audio-wav requires CONFIG_HAS_AUDIO")); break;
       case 'd': diff_so_file = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
@@ -189,6 +222,13 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-e,--elf=FILE           resolve elf file\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-g,--gdb=PORT           wait for gdb to connect to PORT\n");
+        printf("\t-r,--record=FILE        record device inputs to FILE\n");
+        printf("\t-R,--replay=FILE        replay device inputs from FILE\n");
+        printf("\t-s,--stats=FILE         export live statistics to FILE\n");
+        printf("\t-o,--sdcard-overlay=FILE  keep the writes to the sdcard in FILE\n");
+        printf("\t-f,--fb-dump=DIR|FILE   dump the frames as PNGs in DIR or a Y4M stream\n");
+        printf("\t-w,--audio-wav=FILE     write the audio to FILE instead of playing it\n");
         printf("\n");
         exit(0);
     }
@@ -214,6 +254,12 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
+  /* Open the record or the replay of device inputs. */
+  IFDEF(CONFIG_RECORD_REPLAY, init_record(record_file, replay_file));
+
+  /* Export the statistics. */
+  IFDEF(CONFIG_STATS, init_stats(stats_file));
+
   /* Perform ISA dependent initialization. */
   init_isa();
 
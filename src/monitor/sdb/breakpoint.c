@@ -0,0 +1,114 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "sdb.h"
+#include <cpu/reverse.h>
+
+// Breakpoints are also kept in a hash table indexed by their addresses,
+// so checking the pc after every instruction costs only one table lookup
+// when there is no breakpoint at that pc.
+#define BP_HASH_SIZE 1024
+#define BP_HASH(pc) (((pc) >> 1) & (BP_HASH_SIZE - 1))
+
+static BP *bp_hash[BP_HASH_SIZE] = {};
+static BP *head = NULL;
+static int next_no = 0;
+
+BP* new_bp(vaddr_t addr, char *cond) {
+  ExprProg *prog = NULL;
+  if (cond != NULL) {
+    bool success;
+    prog = expr_compile(cond, &success);
+    if (!success) return NULL;
+  }
+
+  BP *bp = malloc(sizeof(BP));
+  assert(bp);
+  bp->NO = next_no ++;
+  bp->addr = addr;
+  bp->cond = prog;
+  strncpy(bp->cond_str, (cond ? cond : ""), sizeof(bp->cond_str) - 1);
+  bp->cond_str[sizeof(bp->cond_str) - 1] = '\0';
+  bp->hit = 0;
+  bp->ignore = 0;
+
+  bp->next = head;
+  head = bp;
+  bp->hash_next = bp_hash[BP_HASH(addr)];
+  bp_hash[BP_HASH(addr)] = bp;
+  return bp;
+}
+
+BP* number2bp(int n) {
+  for (BP *bp = head; bp != NULL; bp = bp->next) {
+    if (bp->NO == n) return bp;
+  }
+  return NULL;
+}
+
+BP* addr2bp(vaddr_t addr) {
+  for (BP *bp = bp_hash[BP_HASH(addr)]; bp != NULL; bp = bp->hash_next) {
+    if (bp->addr == addr) return bp;
+  }
+  return NULL;
+}
+
+void free_bp(BP *bp) {
+  BP **p;
+  for (p = &head; *p != bp; p = &(*p)->next) { Assert(*p, "no bp"); }
+  *p = bp->next;
+  for (p = &bp_hash[BP_HASH(bp->addr)]; *p != bp; p = &(*p)->hash_next) { Assert(*p, "no bp"); }
+  *p = bp->hash_next;
+
+  if (bp->cond) expr_free(bp->cond);
+  free(bp);
+}
+
+void breakpoint_display() {
+  if (head == NULL) {
+    printf("No breakpoints\n");
+  }
+  for (BP *bp = head; bp != NULL; bp = bp->next) {
+    printf("Number: %d\taddress: " FMT_WORD "\thit: %" PRIu64, bp->NO, bp->addr, bp->hit);
+    if (bp->ignore > 0) printf("\tignore next %" PRIu64 " hits", bp->ignore);
+    if (bp->cond) printf("\tif %s", bp->cond_str);
+    printf("\n");
+  }
+}
+
+bool breakpoint_any() {
+  return head != NULL;
+}
+
+// Return true if execution should stop before the instruction at `pc`.
+bool breakpoint_check(vaddr_t pc) {
+  BP *bp = bp_hash[BP_HASH(pc)];
+  if (likely(bp == NULL)) return false;
+
+  bool stop = false;
+  for (; bp != NULL; bp = bp->hash_next) {
+    if (bp->addr != pc) continue;
+    if (bp->cond && expr_eval(bp->cond, NULL, NULL, NULL) == 0) continue;
+    // the counts are not changed again when reverse execution replays
+    if (!reverse_rewinding) bp->hit ++;
+    if (bp->ignore > 0) {
+      if (!reverse_rewinding) bp->ignore --;
+      continue;
+    }
+    if (!reverse_rewinding) printf("Breakpoint %d at " FMT_WORD "\n", bp->NO, pc);
+    stop = true;
+  }
+  return stop;
+}
@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/host.h>
+#include "sdb.h"
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -241,11 +242,40 @@ int check_priority(int a, int b) {
   }
 }
 
-uint64_t eval(int p, int q) {
+/* An expression is compiled into a sequence of operations in postfix order.
+ * It can then be evaluated again and again with a small stack machine,
+ * without tokenizing and parsing the string every time.
+ */
+typedef struct {
+  int type; // TK_DEC for an immediate, TK_REG, TK_DEREF, or a binary operator
+  uint64_t val;
+  char reg[32];
+} ExprOp;
+
+struct ExprProg {
+  int nr_op;
+  bool use_reg;
+  ExprOp op[];
+};
+
+static ExprProg *code = NULL;
+
+static void emit(int type, uint64_t val, const char *reg) {
+  ExprOp *op = &code->op[code->nr_op ++];
+  op->type = type;
+  op->val = val;
+  if (reg != NULL) {
+    strcpy(op->reg, reg);
+    code->use_reg = true;
+  }
+}
+
+static void compile(int p, int q) {
   if (p > q) {
     /* Bad expression */
     Log("Bad expression");
-    return 0;
+    emit(TK_DEC, 0, NULL);
+    return;
   }
   else if (p == q) {
     /* Single token.
@@ -258,15 +288,15 @@ uint64_t eval(int p, int q) {
     switch(tokens[p].type) {
       case TK_DEC:
         sscanf(tokens[p].str, "%lu", &val) ;
-        return val;
+        emit(TK_DEC, val, NULL);
+        return;
       case TK_HEX:
         sscanf(tokens[p].str, "%lx", &val) ;
-        return val;
+        emit(TK_DEC, val, NULL);
+        return;
       case TK_REG:
-        bool success = false;
-        val = isa_reg_str2val(tokens[p].str, &success);
-        if (success) return val;
-        return 0;
+        emit(TK_REG, 0, tokens[p].str);
+        return;
       default:
         panic("unkown type");
 
@@ -277,16 +307,13 @@ uint64_t eval(int p, int q) {
     /* The expression is surrounded by a matched pair of parentheses.
      * If that is the case, just throw away the parentheses.
      */
-    return eval(p + 1, q - 1);
+    compile(p + 1, q - 1);
+    return;
   }
   else if (tokens[p].type == TK_DEREF) {
-    // wait to test
-    paddr_t g_addr = eval(p + 1, q);
-    Assert(g_addr >= CONFIG_MBASE && g_addr <= CONFIG_MBASE + CONFIG_MSIZE, "guest memory under Memory Base");
-    uint8_t *h_addr = guest_to_host(g_addr);
-    return host_read(h_addr, 8);
-    
-
+    compile(p + 1, q);
+    emit(TK_DEREF, 0, NULL);
+    return;
   }
   else {
     /* We should do more things here. */
@@ -316,7 +343,7 @@ uint64_t eval(int p, int q) {
               pos = i;
             } else if (cmp == 1) {
               panic("There is no operation with lower priority than addition and subtraction.");
-              return 0;
+              return;
             } else {
               type = tokens[i].type;
               pos = i;
@@ -354,40 +381,72 @@ uint64_t eval(int p, int q) {
     if (pos < p || pos > q) {
       panic("op should between p and q");
     }
-    uint64_t left = eval(p, pos - 1);
-    uint64_t right = eval(pos + 1, q);
+    compile(p, pos - 1);
+    compile(pos + 1, q);
+    emit(type, 0, NULL);
+  }
+}
+
+// `success` may be NULL, and is set to false if an address is out of range.
+uint64_t expr_eval(ExprProg *e, expr_deref_hook_t hook, void *arg, bool *success) {
+  if (success != NULL) *success = true;
+  uint64_t stack[e->nr_op];
+  int top = 0;
+
+  for (int i = 0; i < e->nr_op; i ++) {
+    ExprOp *op = &e->op[i];
+    if (op->type == TK_DEC) { stack[top ++] = op->val; continue; }
+    if (op->type == TK_REG) {
+      bool success = false;
+      uint64_t val = isa_reg_str2val(op->reg, &success);
+      stack[top ++] = (success ? val : 0);
+      continue;
+    }
+    if (op->type == TK_DEREF) {
+      paddr_t g_addr = stack[top - 1];
+      if (g_addr < CONFIG_MBASE || g_addr > CONFIG_MBASE + CONFIG_MSIZE - sizeof(word_t)) {
+        if (success != NULL) *success = false;
+        stack[top - 1] = 0;
+        continue;
+      }
+      if (hook != NULL) hook(g_addr, sizeof(word_t), arg);
+      stack[top - 1] = host_read(guest_to_host(g_addr), sizeof(word_t));
+      continue;
+    }
 
-    switch (type) {
-      case '+': return left + right;
-      case '-': return left - right;
-      case '*': return left * right;
+    uint64_t right = stack[-- top];
+    uint64_t left = stack[top - 1];
+    uint64_t result;
+    switch (op->type) {
+      case '+': result = left + right; break;
+      case '-': result = left - right; break;
+      case '*': result = left * right; break;
       case '/': 
-        if (right == 0) return 0;
-        return (uint64_t)((int)left / (int)right);
-      case TK_EQ:
-        if (left == right) return 1;
-        return 0;
-      case TK_NEQ:
-        if (left != right) return 1;
-        return 0;
-      case TK_AND:
-        if (left == 0) return 0;
-        return right != 0 ? 1 : 0;
+        result = (right == 0 ? 0 : (uint64_t)((int)left / (int)right));
+        break;
+      case TK_EQ: result = (left == right); break;
+      case TK_NEQ: result = (left != right); break;
+      case TK_AND: result = (left != 0 && right != 0); break;
       default: 
         panic("unknown operation");
     }
-
+    stack[top - 1] = result;
   }
-  return 0;
+  return stack[0];
 }
 
+bool expr_use_reg(ExprProg *e) {
+  return e->use_reg;
+}
 
+void expr_free(ExprProg *e) {
+  free(e);
+}
 
-
-word_t expr(char *e, bool *success) {
+ExprProg* expr_compile(char *e, bool *success) {
   if (!make_token(e)) {
     *success = false;
-    return 0;
+    return NULL;
   }
 
   for (int i = 0; i < nr_token; i ++) {
@@ -396,8 +455,26 @@ word_t expr(char *e, bool *success) {
     }
   }
 
-  uint64_t result __attribute__((unused)) = (uint64_t)eval(0, nr_token - 1);
+  // every token is compiled into at most one operation,
+  // and a bad (empty) subexpression is compiled into an immediate
+  code = malloc(sizeof(ExprProg) + sizeof(ExprOp) * (nr_token + 1));
+  assert(code);
+  code->nr_op = 0;
+  code->use_reg = false;
+  compile(0, nr_token - 1);
+
+  ExprProg *ret = code;
+  code = NULL;
   *success = true;
+  return ret;
+}
+
+word_t expr(char *e, bool *success) {
+  ExprProg *prog = expr_compile(e, success);
+  if (!*success) return 0;
+
+  uint64_t result __attribute__((unused)) = expr_eval(prog, NULL, NULL, success);
+  expr_free(prog);
   // printf("$%d = %lu\n", tr, result);
   return result;
 }
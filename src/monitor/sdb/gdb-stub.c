@@ -0,0 +1,385 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// A GDB remote serial protocol server, so that the guest can be debugged by
+// `target remote :PORT` in gdb. Breakpoints and write watchpoints requested by
+// gdb are backed by the breakpoint hash table and the watched-page bitmap, so
+// the guest runs at full speed between them.
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/reverse.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <difftest-def.h>
+#include "sdb.h"
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+BP* new_bp(vaddr_t addr, char *cond);
+void free_bp(BP *bp);
+BP* addr2bp(vaddr_t addr);
+WP* new_write_wp(paddr_t addr, int len);
+void free_wp(WP *wp);
+
+// The first DIFFTEST_REG_SIZE bytes of CPU_state are laid out as the
+// registers in the `g' packet of gdb, the same as what qemu-diff relies on.
+#define GDB_REG_SIZE DIFFTEST_REG_SIZE
+#define PACKET_SIZE 4096
+#define NR_GDB_WP 32
+#define NR_GDB_BP 64
+
+static FILE *in = NULL, *out = NULL;
+static bool no_ack = false;
+static volatile sig_atomic_t interrupted = false;
+static WP *gdb_wp[NR_GDB_WP] = {};
+// only the breakpoints created by gdb are removed by gdb
+static BP *gdb_bp[NR_GDB_BP] = {};
+
+static const char hex_digit[] = "0123456789abcdef";
+
+static int hex2int(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static char* mem2hex(const uint8_t *mem, char *buf, int len) {
+  for (int i = 0; i < len; i ++) {
+    *buf ++ = hex_digit[mem[i] >> 4];
+    *buf ++ = hex_digit[mem[i] & 0xf];
+  }
+  *buf = '\0';
+  return buf;
+}
+
+static bool hex2mem(const char *buf, uint8_t *mem, int len) {
+  for (int i = 0; i < len; i ++) {
+    int hi = hex2int(buf[2 * i]), lo = hex2int(buf[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    mem[i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+static void put_packet(const char *data) {
+  uint8_t sum = 0;
+  for (const char *p = data; *p != '\0'; p ++) sum += *p;
+
+  int c;
+  do {
+    fprintf(out, "$%s#%02x", data, sum);
+    fflush(out);
+    if (no_ack) return;
+    // skip the interrupt request which may be sent before the ACK
+    while ((c = fgetc(in)) == '\x03');
+  } while (c == '-');
+}
+
+// Return the length of the packet, or -1 if the connection is closed.
+static int get_packet(char *buf) {
+  int c;
+  while (true) {
+    while ((c = fgetc(in)) != '$') {
+      if (c == EOF) return -1;
+    }
+
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = fgetc(in)) != '#') {
+      if (c == EOF) return -1;
+      if (len < PACKET_SIZE - 1) buf[len ++] = c;
+      sum += c;
+    }
+    buf[len] = '\0';
+
+    int hi = hex2int(fgetc(in)), lo = hex2int(fgetc(in));
+    if (no_ack) return len;
+    bool ok = (hi >= 0 && lo >= 0 && ((hi << 4) | lo) == sum);
+    fputc(ok ? '+' : '-', out);
+    fflush(out);
+    if (ok) return len;
+  }
+}
+
+static bool guest_mem_ok(paddr_t addr, int len) {
+  return len >= 0 && in_pmem(addr) && (len == 0 || in_pmem(addr + len - 1));
+}
+
+#ifdef CONFIG_ISA_riscv
+static const char* target_xml() {
+  static char xml[4096] = "";
+  if (xml[0] != '\0') return xml;
+
+  int bits = sizeof(word_t) * 8;
+  char *p = xml;
+  p += sprintf(p, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+      "<target version=\"1.0\"><architecture>riscv:rv%d</architecture>"
+      "<feature name=\"org.gnu.gdb.riscv.cpu\">", bits);
+  for (int i = 0; i < RISCV_GPR_NUM; i ++) {
+    p += sprintf(p, "<reg name=\"x%d\" bitsize=\"%d\" type=\"int\" regnum=\"%d\"/>", i, bits, i);
+  }
+  p += sprintf(p, "<reg name=\"pc\" bitsize=\"%d\" type=\"code_ptr\" regnum=\"32\"/>"
+      "</feature></target>", bits);
+  return xml;
+}
+#else
+// let gdb use the default register layout of the architecture
+static const char* target_xml() { return NULL; }
+#endif
+
+static void handle_qxfer(const char *args, char *reply) {
+  // qXfer:features:read:target.xml:OFFSET,LENGTH
+  const char *xml = target_xml();
+  const char *annex = "features:read:target.xml:";
+  if (xml == NULL || strncmp(args, annex, strlen(annex)) != 0) {
+    reply[0] = '\0';
+    return;
+  }
+  char *end;
+  size_t off = strtoul(args + strlen(annex), &end, 16);
+  size_t len = strtoul(end + 1, NULL, 16);
+  size_t total = strlen(xml);
+  if (off >= total) { strcpy(reply, "l"); return; }
+  if (len > PACKET_SIZE - 2) len = PACKET_SIZE - 2;
+  if (len > total - off) len = total - off;
+  reply[0] = (off + len < total ? 'm' : 'l');
+  memcpy(reply + 1, xml + off, len);
+  reply[len + 1] = '\0';
+}
+
+static void handle_query(const char *buf, char *reply) {
+  if (strncmp(buf, "qSupported", 10) == 0) {
+    sprintf(reply, "PacketSize=%x;QStartNoAckMode+%s%s", PACKET_SIZE,
+        (target_xml() ? ";qXfer:features:read+" : ""),
+        MUXDEF(CONFIG_REVERSE_EXEC, ";ReverseStep+;ReverseContinue+", ""));
+  } else if (strncmp(buf, "qXfer:", 6) == 0) {
+    handle_qxfer(buf + 6, reply);
+  } else if (strcmp(buf, "qAttached") == 0) {
+    strcpy(reply, "1");
+  } else if (strcmp(buf, "QStartNoAckMode") == 0) {
+    strcpy(reply, "OK");
+  } else {
+    reply[0] = '\0';
+  }
+}
+
+// Z0/Z1: breakpoint, Z2: write watchpoint. An empty reply tells gdb that
+// the type is not supported.
+static void handle_z(const char *buf, char *reply) {
+  bool insert = (buf[0] == 'Z');
+  int type = buf[1] - '0';
+  char *end;
+  word_t addr = strtoull(buf + 3, &end, 16);
+  int kind = strtol(end + 1, NULL, 16);
+
+  strcpy(reply, "OK");
+  if ((type == 0 || type == 1) && MUXDEF(CONFIG_BREAKPOINT, true, false)) {
+    int i;
+    if (insert) {
+      // an existing breakpoint of sdb already stops the guest
+      if (addr2bp(addr) != NULL) return;
+      for (i = 0; i < NR_GDB_BP && gdb_bp[i] != NULL; i ++);
+      if (i == NR_GDB_BP) { strcpy(reply, "E01"); return; }
+      gdb_bp[i] = new_bp(addr, NULL);
+    } else {
+      for (i = 0; i < NR_GDB_BP; i ++) {
+        if (gdb_bp[i] != NULL && gdb_bp[i]->addr == addr) {
+          free_bp(gdb_bp[i]);
+          gdb_bp[i] = NULL;
+          break;
+        }
+      }
+    }
+  } else if (type == 2 && MUXDEF(CONFIG_WATCHPOINT, true, false)) {
+    int i;
+    if (insert) {
+      if (!guest_mem_ok(addr, kind)) { strcpy(reply, "E01"); return; }
+      for (i = 0; i < NR_GDB_WP && gdb_wp[i] != NULL; i ++);
+      if (i == NR_GDB_WP) { strcpy(reply, "E01"); return; }
+      gdb_wp[i] = new_write_wp(addr, kind);
+    } else {
+      for (i = 0; i < NR_GDB_WP; i ++) {
+        WP *wp = gdb_wp[i];
+        if (wp != NULL && wp->range[0] == addr && wp->range_len == kind) {
+          free_wp(wp);
+          gdb_wp[i] = NULL;
+          break;
+        }
+      }
+    }
+  } else {
+    reply[0] = '\0';
+  }
+}
+
+static void sigio_handler(int sig) {
+  // gdb sends 0x03 to interrupt the running guest
+  if (nemu_state.state == NEMU_RUNNING) {
+    nemu_state.state = NEMU_STOP;
+    interrupted = true;
+  }
+}
+
+static void stop_reply(char *reply) {
+  if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+    sprintf(reply, "W%02x", (nemu_state.state == NEMU_ABORT ? 0xff : nemu_state.halt_ret & 0xff));
+    return;
+  }
+  if (interrupted) {
+    strcpy(reply, "S02");
+    return;
+  }
+  for (int i = 0; i < NR_GDB_WP; i ++) {
+    WP *wp = gdb_wp[i];
+    if (wp != NULL && wp->hit) {
+      wp->hit = false;
+      sprintf(reply, "T05watch:%" PRIx64 ";", (uint64_t)wp->range[0]);
+      return;
+    }
+  }
+  strcpy(reply, "S05");
+}
+
+static void resume(uint64_t n, char *reply) {
+  interrupted = false;
+  cpu_exec(n);
+  stop_reply(reply);
+}
+
+static int wait_for_gdb(int port) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  Assert(listen_fd >= 0, "socket() failed");
+  int opt = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  struct sockaddr_in sa = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  Assert(bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) == 0, "can not bind to port %d", port);
+  Assert(listen(listen_fd, 1) == 0, "listen() failed");
+
+  Log("Waiting for gdb to connect to port %d", port);
+  int fd = accept(listen_fd, NULL, NULL);
+  Assert(fd >= 0, "accept() failed");
+  close(listen_fd);
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  return fd;
+}
+
+void gdb_mainloop(int port) {
+  int fd = wait_for_gdb(port);
+  in = fdopen(fd, "rb");
+  out = fdopen(dup(fd), "wb");
+  assert(in && out);
+
+  struct sigaction sa = { .sa_handler = sigio_handler, .sa_flags = SA_RESTART };
+  sigaction(SIGIO, &sa, NULL);
+  fcntl(fd, F_SETOWN, getpid());
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC);
+
+  static char buf[PACKET_SIZE], reply[PACKET_SIZE * 2 + 1];
+  while (get_packet(buf) >= 0) {
+    reply[0] = '\0';
+    switch (buf[0]) {
+      case '?': strcpy(reply, "S05"); break;
+      case 'g': mem2hex((uint8_t *)&cpu, reply, GDB_REG_SIZE); break;
+      case 'G':
+        strcpy(reply, (hex2mem(buf + 1, (uint8_t *)&cpu, GDB_REG_SIZE) ? "OK" : "E01"));
+        // $zero is not reset after every instruction with RV_FAST_REG
+        IFDEF(CONFIG_RV_FAST_REG, cpu.gpr[0] = 0);
+        difftest_sync(0, 0);
+        break;
+      case 'p': case 'P': {
+        char *end;
+        int no = strtol(buf + 1, &end, 16);
+        if ((no + 1) * sizeof(word_t) > GDB_REG_SIZE) {
+          // registers not in CPU_state are reported as unavailable
+          if (buf[0] == 'p') {
+            memset(reply, 'x', 2 * sizeof(word_t));
+            reply[2 * sizeof(word_t)] = '\0';
+          } else {
+            strcpy(reply, "OK");
+          }
+          break;
+        }
+        uint8_t *reg = (uint8_t *)&cpu + no * sizeof(word_t);
+        if (buf[0] == 'p') mem2hex(reg, reply, sizeof(word_t));
+        else strcpy(reply, (hex2mem(end + 1, reg, sizeof(word_t)) ? "OK" : "E01"));
+        IFDEF(CONFIG_RV_FAST_REG, cpu.gpr[0] = 0);
+        difftest_sync(0, 0);
+        break;
+      }
+      case 'm': case 'M': {
+        char *end;
+        paddr_t addr = strtoull(buf + 1, &end, 16);
+        int len = strtol(end + 1, &end, 16);
+        if (!guest_mem_ok(addr, len) || (buf[0] == 'm' && len > PACKET_SIZE)) {
+          strcpy(reply, "E14");
+        } else if (buf[0] == 'm') {
+          mem2hex(guest_to_host(addr), reply, len);
+        } else {
+          // like a DMA write, so that reverse execution saves the pages
+          // and watchpoints see the write
+          uint8_t *p = (len == 0 ? NULL : paddr_dma(addr, len, true));
+          strcpy(reply, (len == 0 || hex2mem(end + 1, p, len) ? "OK" : "E01"));
+          if (len > 0) difftest_sync(addr, len);
+        }
+        break;
+      }
+      case 'c': resume(-1, reply); break;
+      case 's': resume(1, reply); break;
+#ifdef CONFIG_REVERSE_EXEC
+      case 'b':
+        interrupted = false;
+        if (buf[1] == 's') { reverse_step(1); stop_reply(reply); }
+        else if (buf[1] == 'c') { reverse_continue(); stop_reply(reply); }
+        break;
+#endif
+      case 'Z': case 'z': handle_z(buf, reply); break;
+      case 'q': case 'Q':
+        handle_query(buf, reply);
+        if (strcmp(buf, "QStartNoAckMode") == 0) {
+          put_packet(reply);
+          no_ack = true;
+          continue;
+        }
+        break;
+      case 'H': strcpy(reply, "OK"); break;
+      case 'D':
+        put_packet("OK");
+        goto out;
+      case 'k':
+        nemu_state.state = NEMU_QUIT;
+        goto out;
+    }
+    put_packet(reply);
+  }
+
+out:
+  fclose(in);
+  fclose(out);
+  if (nemu_state.state != NEMU_END && nemu_state.state != NEMU_ABORT) {
+    nemu_state.state = NEMU_QUIT;
+  }
+}
@@ -15,12 +15,15 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/reverse.h>
+#include <cpu/decode.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <stdio.h>
 #include "sdb.h"
 
 static int is_batch_mode = false;
+static int gdb_port = 0;
 #ifdef CONFIG_FTRACE
 extern char *init;
 extern uint64_t nc;
@@ -34,6 +37,10 @@ WP* new_wp(char *str);
 void free_wp(WP *wp);
 WP* number2addr(int n);
 void watchpoint_display();
+BP* new_bp(vaddr_t addr, char *cond);
+void free_bp(BP *bp);
+BP* number2bp(int n);
+void breakpoint_display();
 word_t expr(char *e, bool *success);
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -77,6 +84,19 @@ static int cmd_p(char *args);
 static int cmd_w(char *args);
 
 static int cmd_d(char *args);
+
+static int cmd_b(char *args);
+
+static int cmd_db(char *args);
+
+static int cmd_ignore(char *args);
+
+#ifdef CONFIG_REVERSE_EXEC
+static int cmd_rsi(char *args);
+
+static int cmd_rc(char *args);
+#endif
+
 static struct {
   const char *name;
   const char *description;
@@ -86,12 +106,19 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   {"si", "Let the program execute N instructions in a single step and then pause. When N is not given, the default is 1", cmd_si },
-  {"info", "info r: Print register status info w: Print monitoring point information", cmd_info},
+  {"info", "info r: Print register status info w: Print monitoring point information b: Print breakpoint information" MUXDEF(CONFIG_INST_STAT, " s: Print instruction statistics", ""), cmd_info},
   {"x", "Find the value of the expression EXPR, use the result as the starting memory address, \
   and output N consecutive 4-byte values ​​in hexadecimal format", cmd_x},
   {"p", "Find the value of the expression EXPR", cmd_p},
   {"w", "Set up monitoring points", cmd_w},
   {"d", "Deleting a Watchpoint", cmd_d},
+  {"b", "b ADDR [if EXPR]: Stop before executing the instruction at ADDR, only if EXPR is non-zero when given", cmd_b},
+  {"db", "Deleting a Breakpoint", cmd_db},
+  {"ignore", "ignore N COUNT: Ignore the next COUNT hits of breakpoint N", cmd_ignore},
+#ifdef CONFIG_REVERSE_EXEC
+  {"rsi", "Go back N instructions. When N is not given, the default is 1", cmd_rsi},
+  {"rc", "Go back to the last stop by breakpoints or watchpoints", cmd_rc},
+#endif
   /* TODO: Add more commands */
 
 };
@@ -109,7 +136,9 @@ static int cmd_w(char *args) {
   } 
 
   WP* wp = new_wp(arg);
-  Assert(wp, "There is no empty watchpoint");
+  if (wp == NULL) {
+    printf("invalid expression\n");
+  }
 
 
   return 0;
@@ -123,12 +152,13 @@ static int cmd_d(char *args) {
     return 0;
   }
   int n = atoi(arg);
-  if (n < 0 || n >= NR_WP) {
+  WP *wp = number2addr(n);
+  if (wp == NULL) {
     printf("wrong watchpoint number\n");
     return 0;
   }
 
-  free_wp(number2addr(n));
+  free_wp(wp);
   printf("delete watchpoint %d\n", n);
 
 
@@ -136,6 +166,70 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+static int cmd_b(char *args) {
+  if (args == NULL) {
+    printf("expect: b ADDR [if EXPR]\n");
+    return 0;
+  }
+
+  char *cond = strstr(args, " if ");
+  if (cond != NULL) {
+    *cond = '\0';
+    cond += 4;
+  }
+
+  bool success;
+  vaddr_t addr = expr(args, &success);
+  if (!success) {
+    printf("invalid address\n");
+    return 0;
+  }
+
+  BP *bp = new_bp(addr, cond);
+  if (bp == NULL) {
+    printf("invalid condition\n");
+    return 0;
+  }
+  printf("Breakpoint %d at " FMT_WORD "\n", bp->NO, bp->addr);
+  return 0;
+}
+
+static int cmd_db(char *args) {
+  char *arg = strtok(args, " ");
+  if (arg == NULL) {
+    printf("expect: db N\n");
+    return 0;
+  }
+  int n = atoi(arg);
+  BP *bp = number2bp(n);
+  if (bp == NULL) {
+    printf("wrong breakpoint number\n");
+    return 0;
+  }
+
+  free_bp(bp);
+  printf("delete breakpoint %d\n", n);
+  return 0;
+}
+
+static int cmd_ignore(char *args) {
+  char *arg = strtok(args, " ");
+  char *count = strtok(NULL, " ");
+  if (arg == NULL || count == NULL) {
+    printf("expect: ignore N COUNT\n");
+    return 0;
+  }
+  BP *bp = number2bp(atoi(arg));
+  if (bp == NULL) {
+    printf("wrong breakpoint number\n");
+    return 0;
+  }
+
+  bp->ignore = strtoull(count, NULL, 0);
+  printf("Will ignore next %" PRIu64 " crossings of breakpoint %d\n", bp->ignore, bp->NO);
+  return 0;
+}
+
 static int cmd_p(char *args) {
   char *arg = strtok(args, "\"");
   bool success;
@@ -146,7 +240,8 @@ static int cmd_p(char *args) {
 
   uint64_t result = expr(arg, &success);
   if (!success) {
-    printf("something wrong in make_token\n");
+    printf("invalid expression or address\n");
+    return 0;
   }
   printf("$%d = %lu   0x%lx\n", tr, result, result);
   tr++;
@@ -235,10 +330,23 @@ static int cmd_si(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_REVERSE_EXEC
+static int cmd_rsi(char *args) {
+  char *arg = strtok(args, " ");
+  reverse_step(arg == NULL ? 1 : strtoull(arg, NULL, 0));
+  return 0;
+}
+
+static int cmd_rc(char *args) {
+  reverse_continue();
+  return 0;
+}
+#endif
+
 static int cmd_info(char *args) {
   char *arg = strtok(args, " ");
   if (arg == NULL) {
-    Log("Need more arguments. expected: info w / r");
+    Log("Need more arguments. expected: info w / r / b");
     return -1;
   } else {
     char c = arg[0];
@@ -249,6 +357,14 @@ static int cmd_info(char *args) {
       case 'w':
         watchpoint_display();
         break;
+      case 'b':
+        breakpoint_display();
+        break;
+#ifdef CONFIG_INST_STAT
+      case 's':
+        inst_stat_display();
+        break;
+#endif
       default:
         Log("wrong argument");
     }
@@ -269,7 +385,18 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
+void sdb_set_gdb_port(int port) {
+  gdb_port = port;
+}
+
+void gdb_mainloop(int port);
+
 void sdb_mainloop() {
+  if (gdb_port != 0) {
+    gdb_mainloop(gdb_port);
+    return;
+  }
+
   if (is_batch_mode) {
     cmd_c(NULL);
 #ifdef CONFIG_FTRACE
@@ -16,18 +16,51 @@
 #ifndef __SDB_H__
 #define __SDB_H__
 
-#define NR_WP 32
+#define NR_WP 32 // initial size of the watchpoint pool
 #include <common.h>
 
+typedef struct ExprProg ExprProg;
+typedef void (*expr_deref_hook_t)(paddr_t addr, int len, void *arg);
+
+#define NR_WP_RANGE 4
+
 typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
   char expr[256];
   uint64_t value;
 
-  /* TODO: Add more members if necessary */
+  ExprProg *prog;
+  // If the expression does not read registers, its value can only change
+  // when the memory it reads is written. Such a watchpoint is only evaluated
+  // again after a write to one of `range`.
+  bool check_always;
+  bool dirty;
+  int nr_range;
+  paddr_t range[NR_WP_RANGE];
+  int range_len;
 
+  // Stop after any write to `range[0]` instead of a change of the value,
+  // used by the gdb stub. `hit` is set when it triggers.
+  bool on_write;
+  bool hit;
 } WP;
+
+typedef struct breakpoint {
+  int NO;
+  vaddr_t addr;
+  ExprProg *cond; // stop only if it is non-zero, NULL for unconditional
+  char cond_str[256];
+  uint64_t hit;
+  uint64_t ignore; // number of hits to ignore before stopping
+  struct breakpoint *next;
+  struct breakpoint *hash_next;
+} BP;
+
 word_t expr(char *e, bool *success);
+ExprProg* expr_compile(char *e, bool *success);
+uint64_t expr_eval(ExprProg *e, expr_deref_hook_t hook, void *arg, bool *success);
+bool expr_use_reg(ExprProg *e);
+void expr_free(ExprProg *e);
 
 #endif
@@ -14,48 +14,121 @@
 ***************************************************************************************/
 
 #include "sdb.h"
+#include <cpu/reverse.h>
+#include <memory/paddr.h>
 
-
-
-
-
-static WP wp_pool[NR_WP] = {};
+// The pool starts with NR_WP watchpoints, and is doubled when it runs out.
+// Watchpoints are allocated in chunks, so their addresses never change.
+static WP **wp_pool = NULL;
+static int nr_wp_pool = 0;
 static WP *head = NULL, *free_ = NULL;
 
-void init_wp_pool() {
+static void grow_wp_pool() {
+  int n = (nr_wp_pool == 0 ? NR_WP : nr_wp_pool * 2);
+  wp_pool = realloc(wp_pool, sizeof(WP *) * n);
+  WP *chunk = calloc(n - nr_wp_pool, sizeof(WP));
+  assert(wp_pool && chunk);
+
   int i;
-  for (i = 0; i < NR_WP; i ++) {
-    wp_pool[i].NO = i;
-    wp_pool[i].next = (i == NR_WP - 1 ? NULL : &wp_pool[i + 1]);
+  for (i = nr_wp_pool; i < n; i ++) {
+    WP *w = &chunk[i - nr_wp_pool];
+    w->NO = i;
+    w->next = (i == n - 1 ? free_ : w + 1);
+    wp_pool[i] = w;
   }
+  free_ = chunk;
+  nr_wp_pool = n;
+}
 
+void init_wp_pool() {
   head = NULL;
-  free_ = wp_pool;
+  free_ = NULL;
+  grow_wp_pool();
 }
 
 
-WP* new_wp(char *str) {
-  Assert(free_ != NULL, "There is no free watch point");
-  WP *w = free_;
-  free_ = free_ -> next;
-  strcpy(w->expr, str);
-  if (strcmp(w->expr, str) != 0) {
-    Assert(0, "fail to copy the expression");
+// number of watchpoints evaluated after every instruction
+static int nr_wp_always = 0;
+// number of watchpoints evaluated only after the memory they read is written
+static int nr_wp_mem = 0;
+static bool wp_dirty = false;
+
+static void record_range(paddr_t addr, int len, void *arg) {
+  WP *wp = arg;
+  if (wp->nr_range < NR_WP_RANGE) wp->range[wp->nr_range] = addr;
+  wp->nr_range ++;
+}
+
+// Mark the pages read by watchpoints, so that paddr_write() only notifies us
+// when one of these pages is written.
+static void update_watched_pages() {
+  paddr_watch_clear();
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp->check_always) continue;
+    for (int i = 0; i < wp->nr_range; i ++) {
+      paddr_watch(wp->range[i], wp->range_len);
+    }
+  }
+}
+
+static uint64_t wp_eval(WP *wp) {
+  wp->nr_range = 0;
+  wp->dirty = false;
+  uint64_t val = expr_eval(wp->prog, wp->check_always ? NULL : record_range, wp, NULL);
+  if (!wp->check_always && wp->nr_range > NR_WP_RANGE) {
+    // too many memory accesses to track
+    wp->check_always = true;
+    nr_wp_mem --;
+    nr_wp_always ++;
   }
+  return val;
+}
+
+WP* new_wp(char *str) {
+  if (free_ == NULL) grow_wp_pool();
   bool success;
-  w->value = expr(str, &success);
+  ExprProg *prog = expr_compile(str, &success);
   if (!success) {
     Log("wrong expression");
     return NULL;
   }
-  if (head == NULL) {
-    head = w;
-    head->next = NULL;
-    return head;
+
+  WP *w = free_;
+  free_ = free_ -> next;
+  strcpy(w->expr, str);
+  if (strcmp(w->expr, str) != 0) {
+    Assert(0, "fail to copy the expression");
   }
+  w->prog = prog;
+  w->range_len = sizeof(word_t);
+  w->on_write = false;
+  w->check_always = expr_use_reg(prog);
+  if (w->check_always) nr_wp_always ++;
+  else nr_wp_mem ++;
+  w->value = wp_eval(w);
+  w->next = head;
+  head = w;
+  update_watched_pages();
+  return w;
+}
 
+WP* new_write_wp(paddr_t addr, int len) {
+  if (free_ == NULL) grow_wp_pool();
+  WP *w = free_;
+  free_ = free_ -> next;
+  snprintf(w->expr, sizeof(w->expr), "write to [" FMT_PADDR ", +%d)", addr, len);
+  w->prog = NULL;
+  w->check_always = false;
+  w->dirty = false;
+  w->nr_range = 1;
+  w->range[0] = addr;
+  w->range_len = len;
+  w->on_write = true;
+  w->hit = false;
+  nr_wp_mem ++;
   w->next = head;
   head = w;
+  update_watched_pages();
   return w;
 }
 
@@ -69,30 +142,24 @@ void free_wp(WP *wp) {
   }
 
   Assert(cur, "no wp");
-  if (prev == NULL) {
-    head = NULL;
-    wp->next = free_;
-    free_ = wp;
-    return;
-  }
-
-  prev->next = wp->next;
-  if (free_ == NULL) {
-    free_ = wp;
-    free_->next = NULL;
-    return;
-  }
-
+  if (wp->check_always) nr_wp_always --;
+  else nr_wp_mem --;
+  expr_free(wp->prog);
+  wp->prog = NULL;
 
+  if (prev == NULL) head = wp->next;
+  else prev->next = wp->next;
   wp->next = free_;
   free_ = wp;
-
-
+  update_watched_pages();
 }
 
 WP* number2addr(int n) {
-  Assert(n >= 0 && n < NR_WP, "expect: n >=0 and n < %d", NR_WP);
-  return &wp_pool[n];
+  if (n < 0 || n >= nr_wp_pool) return NULL;
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp == wp_pool[n]) return wp;
+  }
+  return NULL;
 
 }
 
@@ -110,26 +177,67 @@ void watchpoint_display() {
 }
 
 
+// re-evaluate the watchpoints silently after the state is restored
+void watchpoint_refresh() {
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp->on_write) wp->dirty = wp->hit = false;
+    else wp->value = wp_eval(wp);
+  }
+  wp_dirty = false;
+  update_watched_pages();
+}
+
+// called by paddr_write() when it writes a watched page
+void watchpoint_mem_write(paddr_t addr, int len) {
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp->check_always || wp->dirty) continue;
+    for (int i = 0; i < wp->nr_range; i ++) {
+      if (addr < wp->range[i] + wp->range_len && wp->range[i] < addr + len) {
+        wp->dirty = wp_dirty = true;
+        break;
+      }
+    }
+  }
+}
+
+bool watchpoint_any() {
+  return head != NULL;
+}
+
 bool watchpoint_diff() {
+  if (nr_wp_always == 0 && !wp_dirty) return false;
+  wp_dirty = false;
+
   WP *wp = head;
   bool changed = false;
+  bool mem_wp_evaluated = false;
   while (wp != NULL) {
-    bool success;
-    uint64_t result = expr(wp->expr, &success);
-    Assert(success, "Wrong, can not eval the watchpoint expression's value");
+    if (!wp->check_always && !wp->dirty) {
+      wp = wp->next;
+      continue;
+    }
+    if (wp->on_write) {
+      changed = wp->hit = true;
+      wp->dirty = false;
+      if (!reverse_rewinding) printf("Number: %d\texpression: %s\n", wp->NO, wp->expr);
+      wp = wp->next;
+      continue;
+    }
+    mem_wp_evaluated |= !wp->check_always;
+    uint64_t result = wp_eval(wp);
     if (wp->value != result) {
       changed = true;
-      printf("Number: %d\texpression: %s\n", wp->NO, wp->expr);
-      printf("Old value: %lu\n", wp->value);
-      printf("New value: %lu\n", result);
+      if (!reverse_rewinding) {
+        printf("Number: %d\texpression: %s\n", wp->NO, wp->expr);
+        printf("Old value: %lu\n", wp->value);
+        printf("New value: %lu\n", result);
+      }
       wp->value = result;
     }
 
-    wp = wp->next; 
-
-
+    wp = wp->next;
   }
+  // the addresses read by the expressions may change
+  if (mem_wp_evaluated) update_watched_pages();
   return changed;
 }
-/* TODO: Implement the functionality of watchpoint */
-
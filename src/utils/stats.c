@@ -0,0 +1,111 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/difftest.h>
+#include <device/map.h>
+
+#ifdef CONFIG_STATS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The counters are published through a file mapped with MAP_SHARED, so an
+// external monitor can mmap() the same file and poll it while NEMU is
+// running. Put the file under /dev/shm to keep it in memory. `seq' is odd
+// while the snapshot is being updated, and a reader should retry if `seq'
+// is odd or changes across its read.
+
+#define STATS_MAGIC "NEMUSTA1"
+#define STATS_NR_MAP 32
+
+typedef struct {
+  char name[24];
+  uint64_t nr_read;
+  uint64_t nr_write;
+} MapStats;
+
+typedef struct {
+  char magic[8];
+  uint32_t seq;
+  uint32_t state;         // nemu_state.state
+  uint64_t pc;
+  uint64_t nr_inst;       // g_nr_guest_inst
+  uint64_t host_time_us;  // since NEMU started
+  uint64_t inst_per_sec;  // during the last update interval
+  uint64_t nr_trap;       // calls of isa_raise_intr()
+  uint64_t nr_difftest;   // instructions checked by difftest
+  uint32_t nr_map;
+  uint32_t pad;
+  MapStats map[STATS_NR_MAP];
+} NEMUStats;
+
+uint64_t g_nr_trap = 0;
+uint64_t stats_next_update = -1;
+
+static NEMUStats *stats = NULL;
+static IOMap *maps[STATS_NR_MAP] = {};
+static int nr_map = 0;
+static uint64_t last_inst = 0, last_time = 0;
+
+void stats_add_map(IOMap *map) {
+  if (nr_map < STATS_NR_MAP) maps[nr_map ++] = map;
+}
+
+void stats_update() {
+  extern uint64_t g_nr_guest_inst;
+  if (stats == NULL) return;
+  stats_next_update = g_nr_guest_inst + CONFIG_STATS_INTERVAL;
+
+  uint64_t now = get_time();
+  __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  stats->state = nemu_state.state;
+  stats->pc = cpu.pc;
+  stats->nr_inst = g_nr_guest_inst;
+  stats->host_time_us = now;
+  if (now > last_time) {
+    stats->inst_per_sec = (g_nr_guest_inst - last_inst) * 1000000 / (now - last_time);
+    last_inst = g_nr_guest_inst;
+    last_time = now;
+  }
+  stats->nr_trap = g_nr_trap;
+  stats->nr_difftest = MUXDEF(CONFIG_DIFFTEST, g_nr_difftest_inst, 0);
+  stats->nr_map = nr_map;
+  for (int i = 0; i < nr_map; i ++) {
+    stats->map[i].nr_read = maps[i]->nr_read;
+    stats->map[i].nr_write = maps[i]->nr_write;
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+void init_stats(const char *stats_file) {
+  if (stats_file == NULL) return;
+  int fd = open(stats_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not open '%s'", stats_file);
+  Assert(ftruncate(fd, sizeof(NEMUStats)) == 0, "Can not resize '%s'", stats_file);
+  stats = mmap(NULL, sizeof(NEMUStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(stats != MAP_FAILED, "Can not map '%s'", stats_file);
+  close(fd);
+
+  for (int i = 0; i < nr_map; i ++) {
+    strncpy(stats->map[i].name, maps[i]->name, sizeof(stats->map[i].name) - 1);
+  }
+  memcpy(stats->magic, STATS_MAGIC, sizeof(stats->magic));
+  stats_update();
+  Log("Statistics are exported to %s", stats_file);
+}
+#endif
@@ -44,6 +44,15 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+// return 0 if the host provides no cycle counter
+uint64_t get_host_cycles() {
+#if !defined(CONFIG_TARGET_AM) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
 void init_rand() {
   srand(get_time_internal());
 }
@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+#***************************************************************************************
+# Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+#
+# NEMU is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+#
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+#
+# See the Mulan PSL v2 for more details.
+#**************************************************************************************/
+
+# Throughput benchmark of NEMU. The guest kernels are assembled here into raw
+# riscv32 images, so no cross toolchain is needed. Each kernel is run with
+# --batch, and inst/s, host cycles per guest instruction and the max RSS of
+# NEMU are collected into a JSON report. See `make bench`.
+
+import argparse, json, os, re, struct, subprocess, sys, tempfile, time
+
+MBASE = 0x80000000
+
+# ----------------------------- assembler -----------------------------
+
+REGS = {n: i for i, n in enumerate(
+  "zero ra sp gp tp t0 t1 t2 s0 s1 a0 a1 a2 a3 a4 a5 "
+  "a6 a7 s2 s3 s4 s5 s6 s7 s8 s9 s10 s11 t3 t4 t5 t6".split())}
+CSRS = {"mstatus": 0x300, "mtvec": 0x305, "mepc": 0x341, "mcause": 0x342}
+
+class Asm:
+  def __init__(self):
+    self.code = []
+    self.labels = {}
+    self.fixups = [] # (index, label, encoder(target, pc))
+
+  def pc(self):
+    return MBASE + 4 * len(self.code)
+
+  def label(self, name):
+    self.labels[name] = self.pc()
+
+  def emit(self, inst):
+    self.code.append(inst & 0xffffffff)
+
+  def ref(self, label, enc):
+    self.fixups.append((len(self.code), label, enc))
+    self.emit(0)
+
+  def image(self):
+    for idx, label, enc in self.fixups:
+      self.code[idx] = enc(self.labels[label], MBASE + 4 * idx) & 0xffffffff
+    return b"".join(struct.pack("<I", i) for i in self.code)
+
+  # encodings
+  @staticmethod
+  def r(op, f3, f7, rd, rs1, rs2):
+    return (f7 << 25) | (REGS[rs2] << 20) | (REGS[rs1] << 15) | (f3 << 12) | (REGS[rd] << 7) | op
+  @staticmethod
+  def i(op, f3, rd, rs1, imm):
+    return ((imm & 0xfff) << 20) | (REGS[rs1] << 15) | (f3 << 12) | (REGS[rd] << 7) | op
+  @staticmethod
+  def s(f3, rs2, rs1, imm):
+    return (((imm >> 5) & 0x7f) << 25) | (REGS[rs2] << 20) | (REGS[rs1] << 15) | (f3 << 12) | ((imm & 0x1f) << 7) | 0x23
+  @staticmethod
+  def b(f3, rs1, rs2, off):
+    return ((((off >> 12) & 1) << 31) | (((off >> 5) & 0x3f) << 25) | (REGS[rs2] << 20) | (REGS[rs1] << 15) |
+            (f3 << 12) | (((off >> 1) & 0xf) << 8) | (((off >> 11) & 1) << 7) | 0x63)
+  @staticmethod
+  def j(rd, off):
+    return ((((off >> 20) & 1) << 31) | (((off >> 1) & 0x3ff) << 21) | (((off >> 11) & 1) << 20) |
+            (((off >> 12) & 0xff) << 12) | (REGS[rd] << 7) | 0x6f)
+
+  # instructions
+  def lui(self, rd, imm): self.emit(((imm & 0xfffff) << 12) | (REGS[rd] << 7) | 0x37)
+  def addi(self, rd, rs1, imm): self.emit(self.i(0x13, 0, rd, rs1, imm))
+  def andi(self, rd, rs1, imm): self.emit(self.i(0x13, 7, rd, rs1, imm))
+  def slli(self, rd, rs1, sh): self.emit(self.i(0x13, 1, rd, rs1, sh))
+  def srli(self, rd, rs1, sh): self.emit(self.i(0x13, 5, rd, rs1, sh))
+  def add(self, rd, rs1, rs2): self.emit(self.r(0x33, 0, 0, rd, rs1, rs2))
+  def sub(self, rd, rs1, rs2): self.emit(self.r(0x33, 0, 0x20, rd, rs1, rs2))
+  def xor(self, rd, rs1, rs2): self.emit(self.r(0x33, 4, 0, rd, rs1, rs2))
+  def or_(self, rd, rs1, rs2): self.emit(self.r(0x33, 6, 0, rd, rs1, rs2))
+  def and_(self, rd, rs1, rs2): self.emit(self.r(0x33, 7, 0, rd, rs1, rs2))
+  def sltu(self, rd, rs1, rs2): self.emit(self.r(0x33, 3, 0, rd, rs1, rs2))
+  def lw(self, rd, rs1, imm): self.emit(self.i(0x03, 2, rd, rs1, imm))
+  def sw(self, rs2, rs1, imm): self.emit(self.s(2, rs2, rs1, imm))
+  def beq(self, rs1, rs2, l): self.ref(l, lambda t, pc: self.b(0, rs1, rs2, t - pc))
+  def bne(self, rs1, rs2, l): self.ref(l, lambda t, pc: self.b(1, rs1, rs2, t - pc))
+  def blt(self, rs1, rs2, l): self.ref(l, lambda t, pc: self.b(4, rs1, rs2, t - pc))
+  def jal(self, rd, l): self.ref(l, lambda t, pc: self.j(rd, t - pc))
+  def jalr(self, rd, rs1, imm): self.emit(self.i(0x67, 0, rd, rs1, imm))
+  def csrw(self, csr, rs1): self.emit(self.i(0x73, 1, "zero", rs1, CSRS[csr]))
+  def csrr(self, rd, csr): self.emit(self.i(0x73, 2, rd, "zero", CSRS[csr]))
+  def ecall(self): self.emit(0x00000073)
+  def mret(self): self.emit(0x30200073)
+  def ebreak(self): self.emit(0x00100073)
+
+  # pseudo instructions
+  @staticmethod
+  def hi_lo(imm):
+    lo = imm & 0xfff
+    if lo >= 0x800: lo -= 0x1000
+    return ((imm - lo) >> 12) & 0xfffff, lo
+  def li(self, rd, imm):
+    hi, lo = self.hi_lo(imm & 0xffffffff)
+    if hi != 0:
+      self.lui(rd, hi)
+      if lo != 0: self.addi(rd, rd, lo)
+    else:
+      self.addi(rd, "zero", lo)
+  def la(self, rd, label): # the image is loaded at MBASE, so the absolute address is used
+    self.ref(label, lambda t, pc: (self.hi_lo(t)[0] << 12) | (REGS[rd] << 7) | 0x37)
+    self.ref(label, lambda t, pc: self.i(0x13, 0, rd, rd, self.hi_lo(t)[1]))
+  def mv(self, rd, rs): self.addi(rd, rs, 0)
+  def j_(self, l): self.jal("zero", l)
+  def call(self, l): self.jal("ra", l)
+  def ret(self): self.jalr("zero", "ra", 0)
+  def halt(self):
+    self.li("a0", 0)
+    self.ebreak()
+
+# ------------------------------ kernels ------------------------------
+
+def k_alu(a, n):
+  a.li("t0", n)
+  a.li("a1", 1); a.li("a2", 2)
+  a.label("loop")
+  a.add("a1", "a1", "t0"); a.xor("a2", "a2", "a1"); a.slli("a3", "a2", 3); a.sub("a4", "a3", "a1")
+  a.or_("a5", "a4", "a2"); a.and_("a6", "a5", "a3"); a.srli("a7", "a6", 1); a.add("a1", "a1", "a7")
+  a.addi("t0", "t0", -1)
+  a.bne("t0", "zero", "loop")
+  a.halt()
+
+def k_branch(a, n):
+  # xorshift32, then take data-dependent branches on its low bits
+  a.li("t0", n); a.li("s0", 2463534242)
+  a.label("loop")
+  a.slli("t1", "s0", 13); a.xor("s0", "s0", "t1")
+  a.srli("t1", "s0", 17); a.xor("s0", "s0", "t1")
+  a.slli("t1", "s0", 5); a.xor("s0", "s0", "t1")
+  a.andi("t2", "s0", 1)
+  a.beq("t2", "zero", "even")
+  a.addi("a1", "a1", 1)
+  a.andi("t2", "s0", 2)
+  a.beq("t2", "zero", "next")
+  a.addi("a2", "a2", 1)
+  a.j_("next")
+  a.label("even")
+  a.andi("t2", "s0", 4)
+  a.bne("t2", "zero", "next")
+  a.addi("a3", "a3", 1)
+  a.label("next")
+  a.addi("t0", "t0", -1)
+  a.bne("t0", "zero", "loop")
+  a.halt()
+
+BUF_SIZE = 256 * 1024
+
+def k_memstream(a, n):
+  # copy a buffer to another one word by word, unrolled by 4
+  a.li("t0", n)
+  a.label("outer")
+  a.la("s0", "buf"); a.li("t1", BUF_SIZE); a.add("s1", "s0", "t1"); a.add("s2", "s1", "t1")
+  a.label("loop")
+  a.lw("a1", "s0", 0); a.lw("a2", "s0", 4); a.lw("a3", "s0", 8); a.lw("a4", "s0", 12)
+  a.sw("a1", "s1", 0); a.sw("a2", "s1", 4); a.sw("a3", "s1", 8); a.sw("a4", "s1", 12)
+  a.addi("s0", "s0", 16); a.addi("s1", "s1", 16)
+  a.bne("s1", "s2", "loop")
+  a.addi("t0", "t0", -1)
+  a.bne("t0", "zero", "outer")
+  a.halt()
+  a.emit(0)
+  while a.pc() % 4096 != 0: a.emit(0)
+  a.label("buf")
+
+def k_mmio(a, n, fb=0xa1000000, size=400 * 300 * 4):
+  # fill the frame buffer of VGA
+  a.li("t0", n)
+  a.label("outer")
+  a.li("s0", fb); a.li("t1", size); a.add("s1", "s0", "t1")
+  a.label("loop")
+  a.sw("t0", "s0", 0); a.sw("t0", "s0", 4); a.sw("t0", "s0", 8); a.sw("t0", "s0", 12)
+  a.addi("s0", "s0", 16)
+  a.bne("s0", "s1", "loop")
+  a.addi("t0", "t0", -1)
+  a.bne("t0", "zero", "outer")
+  a.halt()
+
+def k_trap(a, n):
+  # ecall into a handler which skips the ecall and returns with mret
+  a.la("t1", "handler"); a.csrw("mtvec", "t1")
+  a.li("t0", n)
+  a.label("loop")
+  a.ecall()
+  a.addi("t0", "t0", -1)
+  a.bne("t0", "zero", "loop")
+  a.halt()
+  a.label("handler")
+  a.csrr("t2", "mepc"); a.addi("t2", "t2", 4); a.csrw("mepc", "t2")
+  a.mret()
+
+def k_call(a, n):
+  # recursive fib(20)
+  a.la("sp", "stack_top")
+  a.li("s1", n)
+  a.label("outer")
+  a.li("a0", 20)
+  a.call("fib")
+  a.addi("s1", "s1", -1)
+  a.bne("s1", "zero", "outer")
+  a.halt()
+  a.label("fib")
+  a.li("t0", 2)
+  a.blt("a0", "t0", "fib_ret")
+  a.addi("sp", "sp", -12); a.sw("ra", "sp", 0); a.sw("s0", "sp", 4); a.sw("a0", "sp", 8)
+  a.addi("a0", "a0", -1); a.call("fib"); a.mv("s0", "a0")
+  a.lw("a0", "sp", 8); a.addi("a0", "a0", -2); a.call("fib"); a.add("a0", "a0", "s0")
+  a.lw("ra", "sp", 0); a.lw("s0", "sp", 4); a.addi("sp", "sp", 12)
+  a.label("fib_ret")
+  a.ret()
+  for _ in range(16384): a.emit(0)
+  a.label("stack_top")
+
+# name: (generator, iterations for scale = 1, needs vga)
+KERNELS = {
+  "alu":       (k_alu,       2000000, False),
+  "branch":    (k_branch,    1500000, False),
+  "memstream": (k_memstream, 100,     False),
+  "mmio":      (k_mmio,      50,      True),
+  "trap":      (k_trap,      2000000, False),
+  "call":      (k_call,      20,      False),
+}
+
+# ------------------------------ runner -------------------------------
+
+def parse_number(pattern, out):
+  m = re.search(pattern + r" = ([\d,.']+)", out)
+  return None if m is None else float(m.group(1).replace(",", "").replace("'", ""))
+
+def run(nemu, img):
+  start = time.time()
+  p = subprocess.Popen([nemu, "--batch", img], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+  out = p.stdout.read().decode(errors="replace")
+  _, status, usage = os.wait4(p.pid, 0)
+  wall = time.time() - start
+  out = re.sub(r"\x1b\[[0-9;]*m", "", out)
+  ok = os.waitstatus_to_exitcode(status) == 0 and "HIT GOOD TRAP" in out
+  inst = parse_number("total guest instructions", out)
+  us = parse_number("host time spent", out)
+  return {
+    "ok": ok,
+    "guest_inst": int(inst) if inst is not None else None,
+    "host_time_us": int(us) if us is not None else None,
+    "inst_per_sec": int(inst * 1000000 / us) if inst and us else None,
+    "host_cycles_per_inst": parse_number("host cycles per guest instruction", out),
+    "max_rss_kb": usage.ru_maxrss,
+    "wall_time_s": round(wall, 3),
+  }, out
+
+def main():
+  ap = argparse.ArgumentParser(description="NEMU throughput benchmark")
+  ap.add_argument("--nemu", required=True, help="path to the NEMU binary")
+  ap.add_argument("--isa", default="riscv32")
+  ap.add_argument("--fb", type=lambda x: int(x, 0), default=None,
+                  help="address of the VGA frame buffer, the mmio kernel is skipped if not given")
+  ap.add_argument("--scale", type=float, default=1.0, help="scale the number of iterations")
+  ap.add_argument("--out", default=None, help="write the JSON report to this file")
+  ap.add_argument("kernels", nargs="*", help="kernels to run (default: all)")
+  args = ap.parse_args()
+
+  if args.isa != "riscv32":
+    sys.exit("bench: guest kernels are only available for riscv32, but ISA = %s" % args.isa)
+
+  names = args.kernels or list(KERNELS)
+  report = {"nemu": os.path.abspath(args.nemu), "isa": args.isa, "scale": args.scale,
+            "time": time.strftime("%Y-%m-%dT%H:%M:%S"), "kernels": {}}
+  with tempfile.TemporaryDirectory() as tmp:
+    for name in names:
+      gen, iters, need_vga = KERNELS[name]
+      if need_vga and args.fb is None:
+        print("bench: skip %s since VGA is not enabled" % name, file=sys.stderr)
+        continue
+      a = Asm()
+      n = max(1, int(iters * args.scale))
+      gen(a, n) if not need_vga else gen(a, n, fb=args.fb)
+      img = os.path.join(tmp, name + ".bin")
+      with open(img, "wb") as f: f.write(a.image())
+      result, out = run(args.nemu, img)
+      if not result["ok"]:
+        sys.stderr.write(out)
+        print("bench: %s failed" % name, file=sys.stderr)
+      print("bench: %-10s %12s inst/s  %6s cycles/inst  %8d KB" % (name, result["inst_per_sec"],
+            result["host_cycles_per_inst"], result["max_rss_kb"]), file=sys.stderr)
+      report["kernels"][name] = result
+
+  text = json.dumps(report, indent=2)
+  if args.out:
+    with open(args.out, "w") as f: f.write(text + "\n")
+  print(text)
+  return 0 if all(r["ok"] for r in report["kernels"].values()) else 1
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -13,6 +13,8 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#define _GNU_SOURCE // for F_SETSIG and F_SETOWN_EX
+
 // from NEMU
 #include <memory/paddr.h>
 #include <isa-def.h>
@@ -20,9 +22,13 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/kvm.h>
+#include <linux/perf_event.h>
 
 /* CR0 bits */
 #define CR0_PE 1u
@@ -35,6 +41,15 @@
 #define RFLAGS_AF  (1u << 4)
 #define RFLAGS_FIX_MASK (RFLAGS_ID | RFLAGS_AC | RFLAGS_RF | RFLAGS_TF | RFLAGS_AF)
 
+// When asked to execute more than `FF_THRESHOLD' instructions, let the
+// guest run natively and stop it with an overflow of the guest retired
+// instruction counter. The counter is armed `FF_SKID_MARGIN' instructions
+// before the target to absorb the skid of the overflow signal, and the
+// remaining instructions are single-stepped as usual.
+#define FF_THRESHOLD   1024
+#define FF_SKID_MARGIN 256
+#define FF_SIGNAL      SIGRTMIN
+
 struct vm {
   int sys_fd;
   int fd;
@@ -58,6 +73,7 @@ enum {
 
 static struct vm vm;
 static struct vcpu vcpu;
+static int inst_counter_fd = -1;
 static FILE *log_fp = NULL; // only to pass linking
 
 // This should be called everytime after KVM_SET_REGS.
@@ -286,7 +302,101 @@ static void patching_after(uint64_t last_pc) {
   }
 }
 
+static void ff_sig_handler(int signum) {
+  // nothing to do, the signal is only used to kick the vcpu out of KVM_RUN
+}
+
+static void inst_counter_init() {
+  struct perf_event_attr attr = {};
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.sample_period = 1ull << 62;
+  attr.wakeup_events = 1;
+  attr.exclude_host = 1; // only count instructions retired inside the guest
+  attr.disabled = 1;
+  attr.pinned = 1;
+  int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0) {
+    perror("perf_event_open (fast-forward is disabled)");
+    return;
+  }
+
+  struct sigaction s;
+  memset(&s, 0, sizeof(s));
+  s.sa_handler = ff_sig_handler;
+  int ret = sigaction(FF_SIGNAL, &s, NULL);
+  Assert(ret == 0, "Can not set signal handler");
+
+  struct f_owner_ex owner = { .type = F_OWNER_TID, .pid = syscall(__NR_gettid) };
+  if (fcntl(fd, F_SETOWN_EX, &owner) < 0 || fcntl(fd, F_SETSIG, FF_SIGNAL) < 0 ||
+      fcntl(fd, F_SETFL, O_ASYNC) < 0) {
+    perror("fcntl perf_event (fast-forward is disabled)");
+    close(fd);
+    return;
+  }
+  inst_counter_fd = fd;
+}
+
+static uint64_t inst_counter_read() {
+  uint64_t count;
+  int ret = read(inst_counter_fd, &count, sizeof(count));
+  assert(ret == sizeof(count));
+  return count;
+}
+
+// Let the guest run natively for at most `n - FF_SKID_MARGIN' instructions.
+// Return the number of instructions actually executed.
+static uint64_t kvm_exec_native(uint64_t n) {
+  uint64_t target = n - FF_SKID_MARGIN;
+  int ret = ioctl(inst_counter_fd, PERF_EVENT_IOC_PERIOD, &target);
+  assert(ret == 0);
+  ioctl(inst_counter_fd, PERF_EVENT_IOC_RESET, 0);
+
+  // leave single step mode, and do not let the guest see TF
+  struct kvm_guest_debug debug = {};
+  if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
+    perror("KVM_SET_GUEST_DEBUG");
+    assert(0);
+  }
+  vcpu.kvm_run->s.regs.regs.rflags &= ~RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+
+  ioctl(inst_counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  while (true) {
+    if (ioctl(vcpu.fd, KVM_RUN, 0) < 0) {
+      if (errno == EINTR) {
+        if (inst_counter_read() >= target) break;
+        continue;
+      }
+      perror("KVM_RUN");
+      assert(0);
+    }
+    if (vcpu.kvm_run->exit_reason == KVM_EXIT_HLT) break;
+    // NEMU always synchronizes before device accesses, so the REF should
+    // never reach them by itself
+    panic("Got exit_reason %d at pc = 0x%llx during fast-forward",
+        vcpu.kvm_run->exit_reason, vcpu.kvm_run->s.regs.regs.rip);
+  }
+  ioctl(inst_counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  uint64_t count = inst_counter_read();
+  Assert(count <= n, "skid of the instruction counter is too large, "
+      "executed = %" PRIu64 ", expected <= %" PRIu64, count, n);
+
+  // back to single step mode
+  vcpu.kvm_run->s.regs.regs.rflags |= RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  kvm_set_step_mode(false, 0);
+  return count;
+}
+
 static void kvm_exec(uint64_t n) {
+  if (n > FF_THRESHOLD && inst_counter_fd >= 0 && vcpu.int_wp_state == STATE_IDLE) {
+    n -= kvm_exec_native(n);
+    if (vcpu.kvm_run->exit_reason == KVM_EXIT_HLT) return;
+  }
+
   for (; n > 0; n --) {
     if (patching()) continue;
 
@@ -406,4 +516,5 @@ __EXPORT void difftest_init(int port) {
   vm_init(CONFIG_MSIZE);
   vcpu_init();
   run_protected_mode();
+  inst_counter_init();
 }
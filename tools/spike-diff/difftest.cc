@@ -15,6 +15,7 @@
 
 #include "mmu.h"
 #include "sim.h"
+#include <algorithm>
 #include "../../include/common.h"
 #include <difftest-def.h>
 
@@ -36,6 +37,8 @@ static debug_module_config_t difftest_dm_config = {
   .support_impebreak = true
 };
 
+// This should be consistent with riscv CPU_state in NEMU.
+// Remember to bump DIFFTEST_CTX_VERSION when changing the layout.
 struct diff_context_t {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   word_t pc;
@@ -43,8 +46,15 @@ struct diff_context_t {
   word_t mtvec;
   word_t mepc;
   word_t mcause;
+  word_t mscratch;
+  word_t satp;
+  uint32_t mode;
 };
 
+extern "C" {
+__EXPORT uint32_t difftest_ctx_version = DIFFTEST_CTX_VERSION;
+}
+
 static sim_t* s = NULL;
 static processor_t *p = NULL;
 static state_t *state = NULL;
@@ -64,11 +74,13 @@ void sim_t::diff_get_regs(void* diff_context) {
     ctx->gpr[i] = state->XPR[i];
   }
   ctx->pc = state->pc;
-  ctx->mcause = state->mcause->read();
-  ctx->mstatus = state->mstatus->read();
-  ctx->mepc = state->mepc->read();
-  ctx->mtvec = state->mtvec->read();
-  
+  ctx->mstatus = p->get_csr(CSR_MSTATUS);
+  ctx->mtvec = p->get_csr(CSR_MTVEC);
+  ctx->mepc = p->get_csr(CSR_MEPC);
+  ctx->mcause = p->get_csr(CSR_MCAUSE);
+  ctx->mscratch = p->get_csr(CSR_MSCRATCH);
+  ctx->satp = p->get_csr(CSR_SATP);
+  ctx->mode = state->prv;
 }
 
 void sim_t::diff_set_regs(void* diff_context) {
@@ -77,26 +89,51 @@ void sim_t::diff_set_regs(void* diff_context) {
     state->XPR.write(i, (sword_t)ctx->gpr[i]);
   }
   state->pc = ctx->pc;
-  //state->mcause->write(ctx->mcause);
-  //state->mstatus->write(ctx->mstatus);
-  //state->mepc->write(ctx->mepc);
-  //state->mtvec->write(ctx->mtvec);
+  p->put_csr(CSR_MSTATUS, ctx->mstatus);
+  p->put_csr(CSR_MTVEC, ctx->mtvec);
+  p->put_csr(CSR_MEPC, ctx->mepc);
+  p->put_csr(CSR_MCAUSE, ctx->mcause);
+  p->put_csr(CSR_MSCRATCH, ctx->mscratch);
+  p->put_csr(CSR_SATP, ctx->satp);
+  if (state->prv != ctx->mode) {
+    state->prv = ctx->mode;
+    p->get_mmu()->flush_tlb();
+  }
 }
 
-void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
-  mmu_t* mmu = p->get_mmu();
-  for (size_t i = 0; i < n; i++) {
-    mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
+// Copy between `buf` and the memory of REF through the host pointer of
+// mem_t page by page, instead of storing byte by byte through the MMU.
+static void diff_mem_transfer(reg_t addr, void *buf, size_t n, bool to_ref) {
+  reg_t base = difftest_mem[0].first;
+  mem_t *mem = difftest_mem[0].second;
+  assert(addr >= base && addr - base + n <= mem->size());
+
+  reg_t offset = addr - base;
+  uint8_t *p = (uint8_t *)buf;
+  while (n > 0) {
+    size_t len = std::min<size_t>(n, PGSIZE - (offset % PGSIZE));
+    char *host = mem->contents(offset);
+    if (to_ref) memcpy(host, p, len);
+    else memcpy(p, host, len);
+    offset += len;
+    p += len;
+    n -= len;
   }
 }
 
+void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
+  diff_mem_transfer(dest, src, n, true);
+  // the memory may contain instructions which are already decoded
+  p->get_mmu()->flush_icache();
+}
+
 extern "C" {
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_mem_transfer(addr, buf, n, false);
   }
 }
 